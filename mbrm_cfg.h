@@ -64,4 +64,108 @@
  */
 #define MBRM_DEVICE_NAME_LENTH 5
 
+/**
+ * Type of decoded engineering values.
+ * 0(def): float
+ * other: double
+ */
+#define MBRM_VALUE_DOUBLE 0
+
+/**
+ * Storage of the bus selected by each thread, empty on a target without
+ * thread-local storage, the threads then share one selection(def: _Thread_local).
+ */
+#define MBRM_TLS _Thread_local
+
+/**
+ * Switch of frame tracer(def = CLOSE).
+ */
+#define MBRM_TRACE_SWITCH 0
+
+/**
+ * Number of events kept by the frame tracer, must be a power of 2(def: 64).
+ */
+#define MBRM_TRACE_DEPTH 64
+
+/**
+ * Bytes of frame stored in each trace event(def: 32; max: 256).
+ */
+#define MBRM_TRACE_SNAP_LENTH 32
+
+/**
+ * Switch of shared-memory publication of read commands, POSIX only(def = CLOSE).
+ */
+#define MBRM_SHM_SWITCH 0
+
+/**
+ * Maximum of slaves kept by a bus discovery scan(def: 32).
+ */
+#define MBRM_SCAN_RESULT_MAX 32
+
+/**
+ * Switch of Modbus TCP gateway, Linux only(def = CLOSE).
+ */
+#define MBRM_GATEWAY_SWITCH 0
+
+/**
+ * Maximum of TCP clients served by the gateway(def: 16).
+ */
+#define MBRM_GATEWAY_CLIENT_MAX 16
+
+/**
+ * Maximum of requests held by the gateway(def: 32).
+ */
+#define MBRM_GATEWAY_TRANS_MAX 32
+
+/**
+ * Maximum of clients waiting on one coalesced read(def: 8).
+ */
+#define MBRM_GATEWAY_WAITER_MAX 8
+
+/**
+ * Requests the gateway keeps in the RTU queue at once(def: 2).
+ */
+#define MBRM_GATEWAY_BUS_DEPTH 2
+
+/**
+ * Reply bytes kept per client that is not reading, a client that falls
+ * further behind is closed(def: 1040).
+ */
+#define MBRM_GATEWAY_TX_MAX 1040
+
+/**
+ * Switch of the mmap flight recorder of finished transactions, POSIX only(def = CLOSE).
+ */
+#define MBRM_REC_SWITCH 0
+
+/**
+ * Switch of heap accounting of the device layer(def = CLOSE).
+ */
+#define MBRM_MEM_SWITCH 0
+
+/**
+ * Switch of the event-loop driver of the serial port, POSIX only(def = CLOSE).
+ */
+#define MBRM_LOOP_SWITCH 0
+
+/**
+ * Switch of the thread-per-bus executor, Linux only, needs MBRM_LOOP_SWITCH(def = CLOSE).
+ */
+#define MBRM_SHARD_SWITCH 0
+
+/**
+ * Maximum of buses run by the executor(def: 8).
+ */
+#define MBRM_SHARD_MAX 8
+
+/**
+ * Requests outstanding per bus of the executor, must be a power of 2(def: 64).
+ */
+#define MBRM_SHARD_RING_DEPTH 64
+
+/**
+ * Bytes of command data carried by an executor request or completion(def: 256).
+ */
+#define MBRM_SHARD_DATA_MAX 256
+
 #endif /* _MODBUS_RTU_MASTER_MBRM_CFG_H_ */
@@ -0,0 +1,218 @@
+/*
+ * mbrm_coro.hpp
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_CORO_HPP_
+#define _MODBUS_RTU_MASTER_MBRM_CORO_HPP_
+
+/**
+ * C++20 layer over mbrm_device_class_t. Requests are awaited from a
+ * coroutine, the awaiter lives in the coroutine frame and is passed to
+ * dev_request as user_param, so no allocation is added per request.
+ * The coroutine resumes inside the pop signal, on the thread calling
+ * receive/timer_over; the mutex given to init must be recursive when
+ * it issues the next request from there. A read with a filter resumes
+ * on every answer, the changed bitmap tells whether the data moved.
+ */
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <utility>
+
+extern "C" {
+#include "mbrm_device.h"
+}
+
+namespace mbrm
+{
+
+/**
+ * Fire and forget coroutine type, the frame is freed when it returns.
+ */
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {}
+    };
+};
+
+/**
+ * Outcome of a request. ret is the dev_request return value, status is
+ * only meaningful when ret is 0.
+ */
+template <typename T>
+struct result
+{
+    int ret;
+    mbrm_queue_status_t status;
+    std::span<const T> data;
+
+    bool ok() const noexcept { return ret == 0 && status == MBRM_QUEUE_STATUS_FINISH; }
+};
+
+template <typename T>
+class request_awaiter
+{
+public:
+    request_awaiter(const char *name, int cmd, std::size_t num, uint32_t deadline) noexcept
+        : name_(name), cmd_(cmd), deadline_(deadline), num_(num) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        mbrm_device_req_t req = {deadline_, &request_awaiter::_complete, this};
+        uint8_t expected = PENDING;
+        int ret;
+
+        handle_ = h;
+        ret = get_mbrm_devive_obj()->dev_request(const_cast<char *>(name_), cmd_, &req, nullptr);
+        if (ret != 0)
+        {
+            /* Not queued, resume at once with the error. */
+            ret_ = ret;
+            return false;
+        }
+        /* Completed inside dev_request, e.g. past its deadline: keep running. */
+        return state_.compare_exchange_strong(expected, SUSPENDED, std::memory_order_acq_rel);
+    }
+
+    result<T> await_resume() const noexcept
+    {
+        return {ret_, status_, {static_cast<const T *>(data_), data_ ? num_ : 0}};
+    }
+
+private:
+    static void _complete(mbrm_queue_status_t status, void *data, void *user_param)
+    {
+        auto *self = static_cast<request_awaiter *>(user_param);
+
+        self->status_ = status;
+        self->data_ = data;
+        /* Only resume a coroutine await_suspend has let go of. */
+        if (self->state_.exchange(COMPLETED, std::memory_order_acq_rel) == SUSPENDED)
+        {
+            self->handle_.resume();
+        }
+    }
+
+    enum : uint8_t
+    {
+        PENDING,
+        SUSPENDED,
+        COMPLETED,
+    };
+
+    const char *name_;
+    int cmd_;
+    uint32_t deadline_;
+    int ret_ = 0;
+    mbrm_queue_status_t status_ = MBRM_QUEUE_STATUS_WAIT;
+    void *data_ = nullptr;
+    std::size_t num_ = 0;
+    std::coroutine_handle<> handle_;
+    std::atomic<uint8_t> state_{PENDING};
+};
+
+/**
+ * RAII registration of a device. The info and cmd_list must outlive the
+ * object, the device is detached by the destructor.
+ */
+class device
+{
+public:
+    explicit device(mbrm_device_info_t &info) noexcept
+        : info_(&info), ret_(get_mbrm_devive_obj()->dev_register(&info)) {}
+
+    device(const device &) = delete;
+    device &operator=(const device &) = delete;
+
+    device(device &&o) noexcept
+        : info_(std::exchange(o.info_, nullptr)), ret_(o.ret_) {}
+
+    device &operator=(device &&o) noexcept
+    {
+        if (this != &o)
+        {
+            _detach();
+            info_ = std::exchange(o.info_, nullptr);
+            ret_ = o.ret_;
+        }
+        return *this;
+    }
+
+    ~device() { _detach(); }
+
+    /* dev_register result, 0: Registered. */
+    int status() const noexcept { return ret_; }
+    const char *name() const noexcept { return info_->name; }
+
+    /**
+     * Read command cmd, T is the element type of its data, e.g. uint16_t
+     * for MBRM_TYPE_16 or float for MBRM_TYPE_FLOAT32.
+     */
+    template <typename T>
+    request_awaiter<T> read(int cmd, uint32_t deadline = 0) const noexcept
+    {
+        return {info_->name, cmd, info_->cmd_list[cmd].num, deadline};
+    }
+
+    /**
+     * Copy values into the data of write command cmd and send it.
+     */
+    template <typename T>
+    request_awaiter<T> write(int cmd, std::span<const T> values, uint32_t deadline = 0) const noexcept
+    {
+        mbrm_device_cmd_t *pcmd = &info_->cmd_list[cmd];
+
+        std::memcpy(pcmd->data, values.data(),
+                    (values.size() < pcmd->num ? values.size() : pcmd->num) * sizeof(T));
+        return {info_->name, cmd, info_->cmd_list[cmd].num, deadline};
+    }
+
+private:
+    void _detach() noexcept
+    {
+        if (info_ != nullptr && ret_ == 0)
+        {
+            get_mbrm_devive_obj()->dev_detach(info_->name);
+        }
+        info_ = nullptr;
+    }
+
+    mbrm_device_info_t *info_;
+    int ret_;
+};
+
+} // namespace mbrm
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_CORO_HPP_ */
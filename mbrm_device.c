@@ -24,61 +24,292 @@
  */
 
 #include "mbrm_device.h"
+#include "mbrm_shm.h"
+#include "mbrm_mem.h"
 #include "stdlib.h"
 #include "string.h"
 
 static mbrm_device_class_t mbrm_dev;
-static mbrm_device_class_private_t *mbrm_dev_priv;
+/* Bus selected by the calling thread, NULL: The default one. */
+static MBRM_TLS mbrm_bus_t *mbrm_dev_bus;
 
+/**
+ * @brief
+ * @param
+ * @return State of the bus selected by the calling thread.
+ */
+static mbrm_device_class_private_t *_mbrm_dev_ctx(void)
+{
+    return (mbrm_dev_bus != NULL) ? &mbrm_dev_bus->device : (mbrm_device_class_private_t *)mbrm_dev.priv;
+}
+
+/**
+ * @brief Enter a read section, devices seen inside it are not freed.
+ * @param
+ * @return Epoch to pass to _mbrm_dev_read_unlock.
+ */
+static uint32_t _mbrm_dev_read_lock(void)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    uint32_t e;
+
+    for (;;)
+    {
+        e = __atomic_load_n(&mbrm_dev_priv->epoch, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&mbrm_dev_priv->active[e & 1], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&mbrm_dev_priv->epoch, __ATOMIC_SEQ_CST) == e)
+        {
+            return e;
+        }
+        __atomic_sub_fetch(&mbrm_dev_priv->active[e & 1], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * @brief
+ * @param e
+ */
+static void _mbrm_dev_read_unlock(uint32_t e)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+
+    __atomic_sub_fetch(&mbrm_dev_priv->active[e & 1], 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Writers take the mutex given to init, readers never do.
+ * @param
+ */
+static void _mbrm_dev_write_lock(void)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+
+    RUN_CB(mbrm_dev_priv->mutex_lock);
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_dev_write_unlock(void)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+
+    RUN_CB(mbrm_dev_priv->mutex_unlock);
+}
+
+/**
+ * @brief Call inside a read section or with the write lock held.
+ * @param name
+ * @return NULL: Target not found.
+ */
+static mbrm_device_t *_mbrm_dev_find(const char *name)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    mbrm_device_t *pdev = __atomic_load_n(&mbrm_dev_priv->devs, __ATOMIC_ACQUIRE);
+
+    for (; pdev != NULL; pdev = __atomic_load_n(&pdev->next, __ATOMIC_ACQUIRE))
+    {
+        if (strncmp(pdev->info.name, name, MBRM_DEVICE_NAME_LENTH) == 0)
+        {
+            return pdev;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief malloc_hock charged to a call site.
+ * @param site
+ * @param size
+ * @return
+ */
+static void *_mbrm_dev_malloc(mbrm_mem_site_t site, size_t size)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    void *p = mbrm_dev_priv->malloc_hock(size);
+
+    MBRM_MEM_ALLOC(site, size, p);
+    return p;
+}
+
+/**
+ * @brief free_hock charged to a call site.
+ * @param site
+ * @param p
+ * @param size Size given to _mbrm_dev_malloc.
+ */
+static void _mbrm_dev_free(mbrm_mem_site_t site, void *p, size_t size)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+
+    MBRM_MEM_FREE(site, size);
+    mbrm_dev_priv->free_hock(p);
+}
+
+/**
+ * @brief Free the detached devices nobody can reach any more. The epoch
+ *        moves on once no reader is left in the one before it.
+ * @param
+ */
+static void _mbrm_dev_reclaim(void)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    mbrm_device_t **pp = &mbrm_dev_priv->retired;
+    mbrm_device_t *p;
+    uint32_t e = __atomic_load_n(&mbrm_dev_priv->epoch, __ATOMIC_SEQ_CST);
+    uint8_t i;
+
+    if (mbrm_dev_priv->retired == NULL)
+    {
+        return;
+    }
+    /* Without readers two steps make the devices retired now free. */
+    for (i = 0; i < 2 && __atomic_load_n(&mbrm_dev_priv->active[(e + 1) & 1], __ATOMIC_SEQ_CST) == 0; i++)
+    {
+        __atomic_store_n(&mbrm_dev_priv->epoch, ++e, __ATOMIC_SEQ_CST);
+    }
+    while ((p = *pp) != NULL)
+    {
+        if (e - p->retire >= 2 && __atomic_load_n(&p->refs, __ATOMIC_ACQUIRE) == 0)
+        {
+            *pp = p->retired_next;
+            _mbrm_dev_free(MBRM_MEM_SITE_DEVICE, p, sizeof(mbrm_device_t) + 8 * p->info.cmd_num);
+            continue;
+        }
+        pp = &p->retired_next;
+    }
+}
+
+/**
+ * @brief Free what the completions released since the last writer. The
+ *        pop signal only drops its ref, it may run with the mutex held.
+ * @param
+ */
+static void _mbrm_dev_try_reclaim(void)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+
+    if (__atomic_load_n(&mbrm_dev_priv->retired, __ATOMIC_ACQUIRE) == NULL)
+    {
+        return;
+    }
+    _mbrm_dev_write_lock();
+    _mbrm_dev_reclaim();
+    _mbrm_dev_write_unlock();
+}
+
+/**
+ * @brief
+ * @param type
+ * @return Bytes of one element.
+ */
+static uint8_t _mbrm_dev_type_size(mbrm_device_type_t type)
+{
+    switch (type)
+    {
+    case MBRM_TYPE_32:
+    case MBRM_TYPE_INT32:
+    case MBRM_TYPE_UINT32:
+    case MBRM_TYPE_FLOAT32:
+        return 4;
+    case MBRM_TYPE_FLOAT64:
+    case MBRM_TYPE_INT64:
+        return 8;
+    default:
+        return 2;
+    }
+}
+
+/**
+ * @brief Encode the 0x03 request of a command into the frames of the device.
+ * @param p
+ * @param pcmd
+ */
+static void _mbrm_dev_build_frame(mbrm_device_t *p, const mbrm_device_cmd_t *pcmd)
+{
+    uint8_t *frame = p->frames[pcmd - p->info.cmd_list];
+    uint16_t len = pcmd->num * (_mbrm_dev_type_size(pcmd->type) / 2);
+    uint16_t crc_code;
+
+    if (pcmd->cmd != 0x03 || len > 0xff)
+    {
+        return;
+    }
+    frame[0] = p->info.slave_addr;
+    frame[1] = 0x03;
+    frame[2] = pcmd->register_addr >> 8;
+    frame[3] = pcmd->register_addr & 0xff;
+    frame[4] = 0;
+    frame[5] = len;
+    crc_code = mbrm_dev.protocol->get_crc(frame, 6);
+    frame[6] = crc_code & 0xff;
+    frame[7] = crc_code >> 8;
+}
+
+/**
+ * @brief Append a device, with the write lock held.
+ * @param info
+ * @return 0 Succeed; 2: Memory alloc fail.
+ */
 static int _mbrm_dev_insert(mbrm_device_info_t *info)
 {
-    mbrm_device_t *p = (mbrm_device_t *)mbrm_dev_priv->malloc_hock(sizeof(mbrm_device_t));
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    mbrm_device_t **pp = &mbrm_dev_priv->devs;
+    mbrm_device_t *p = (mbrm_device_t *)_mbrm_dev_malloc(MBRM_MEM_SITE_DEVICE, sizeof(mbrm_device_t) + 8 * info->cmd_num);
+    uint8_t i;
+
     if (p == NULL)
     {
         mbrm_log_e("Memory alloc fail.\r\n");
         return 2;
     }
 
+    memset(p, 0, sizeof(mbrm_device_t));
     p->info = *info;
-
-    if (mbrm_dev_priv->devs == NULL)
+    if (info->cmd_num > 0)
     {
-        p->next = p;
-        p->prev = p;
-        mbrm_dev_priv->devs = p;
+        /* Owned by the device, devices sharing a cmd_list keep their own. */
+        p->frames = (uint8_t (*)[8])(p + 1);
+        for (i = 0; i < info->cmd_num; i++)
+        {
+            _mbrm_dev_build_frame(p, &info->cmd_list[i]);
+        }
     }
-    else
+
+    while (*pp != NULL)
     {
-        p->next = mbrm_dev_priv->devs;
-        p->prev = mbrm_dev_priv->devs->prev;
-        p->next->prev = p;
-        p->prev->next = p;
+        pp = &(*pp)->next;
     }
+    /* Readers see the device complete or not at all. */
+    __atomic_store_n(pp, p, __ATOMIC_RELEASE);
     mbrm_log_i("Device \"%s\" insert succeed.\r\n", p->info.name);
     return 0;
 }
 
+/**
+ * @brief Unlink a device, with the write lock held. Readers already on it
+ *        still follow its next pointer, it is freed by _mbrm_dev_reclaim.
+ * @param p
+ */
 static void _mbrm_dev_remove(mbrm_device_t *p)
 {
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    mbrm_device_t **pp = &mbrm_dev_priv->devs;
 
-    if (p->next == p)
+    while (*pp != NULL && *pp != p)
     {
-        /* Only one. */
-        mbrm_dev_priv->free_hock(p);
-        mbrm_dev_priv->devs = NULL;
+        pp = &(*pp)->next;
     }
-    else
+    if (*pp == NULL)
     {
-        /* Tow or more. */
-        if (mbrm_dev_priv->devs == p)
-        {
-            mbrm_dev_priv->devs = p->next;
-        }
-        p->next->prev = p->prev;
-        p->prev->next = p->next;
-
-        mbrm_dev_priv->free_hock(p);
+        return;
     }
+    __atomic_store_n(pp, p->next, __ATOMIC_RELEASE);
+    p->retire = __atomic_load_n(&mbrm_dev_priv->epoch, __ATOMIC_SEQ_CST);
+    p->retired_next = mbrm_dev_priv->retired;
+    __atomic_store_n(&mbrm_dev_priv->retired, p, __ATOMIC_RELEASE);
+    _mbrm_dev_reclaim();
 }
 
 /**
@@ -88,34 +319,32 @@ static void _mbrm_dev_remove(mbrm_device_t *p)
  */
 static int _mbrm_dev_detach(char *name)
 {
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    mbrm_device_t *pdev;
+
     if ((name == NULL))
     {
         mbrm_log_e("device_detach: Parameter err.\r\n");
         return -1;
     }
 
-    if (mbrm_dev_priv->devs != NULL)
-    {
-        mbrm_device_t *pdev = mbrm_dev_priv->devs;
-        do
-        {
-            if (strncmp(pdev->info.name, name, MBRM_DEVICE_NAME_LENTH) == 0)
-            {
-                mbrm_dev_priv->remove(pdev);
-                return 0;
-            }
-            pdev = pdev->next;
-        }
-        while (pdev != mbrm_dev_priv->devs);
-
-        mbrm_log_w("device_detach: Not found target.\r\n");
-        return 1;
-    }
-    else
+    _mbrm_dev_write_lock();
+    if (mbrm_dev_priv->devs == NULL)
     {
+        _mbrm_dev_write_unlock();
         mbrm_log_w("device_detach: Device list is null.\r\n");
         return 2;
     }
+    pdev = _mbrm_dev_find(name);
+    if (pdev == NULL)
+    {
+        _mbrm_dev_write_unlock();
+        mbrm_log_w("device_detach: Not found target.\r\n");
+        return 1;
+    }
+    mbrm_dev_priv->remove(pdev);
+    _mbrm_dev_write_unlock();
+    return 0;
 }
 
 /**
@@ -125,6 +354,9 @@ static int _mbrm_dev_detach(char *name)
  */
 static int _mbrm_dev_register(mbrm_device_info_t *info)
 {
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    int ret;
+
     if (info == NULL)
     {
         mbrm_log_e("device_register: parameter err.\r\n");
@@ -136,40 +368,278 @@ static int _mbrm_dev_register(mbrm_device_info_t *info)
         return -1;
     }
 
-    if (mbrm_dev_priv->devs != NULL)
+    _mbrm_dev_write_lock();
+    if (_mbrm_dev_find(info->name) != NULL)
+    {
+        _mbrm_dev_write_unlock();
+        mbrm_log_w("device_detach: Target already exists.\r\n");
+        return 1;
+    }
+    ret = mbrm_dev_priv->insert(info);
+    _mbrm_dev_write_unlock();
+    return ret;
+}
+
+/**
+ * @brief Position on the wire of byte k (LSB first) of a 64 bit element.
+ * @param mode
+ * @param k
+ * @return
+ */
+static uint8_t _mbrm_dev_pos_64(mbrm_device_32_mode_t mode, uint8_t k)
+{
+    uint8_t word_hi = (mode == MBRM_DEV_32_1234 || mode == MBRM_DEV_32_2143);
+    uint8_t byte_hi = (mode == MBRM_DEV_32_1234 || mode == MBRM_DEV_32_3412);
+
+    return (word_hi ? 3 - k / 2 : k / 2) * 2 + (byte_hi ? 1 - k % 2 : k % 2);
+}
+
+/**
+ * @brief Convert the decoded block to engineering values.
+ * @param pcmd
+ */
+static void _mbrm_dev_convert(const mbrm_device_cmd_t *pcmd)
+{
+    mbrm_value_t scale = (pcmd->scale == 0) ? 1 : pcmd->scale;
+    mbrm_value_t offset = pcmd->offset;
+    mbrm_value_t *value = pcmd->value;
+    uint16_t i, num = pcmd->num;
+
+    /* One tight loop per type, so the compiler can vectorize it. */
+    switch (pcmd->type)
+    {
+    case MBRM_TYPE_INT16:
+    {
+        const int16_t *raw = (const int16_t *)pcmd->data;
+        for (i = 0; i < num; i++)
+        {
+            value[i] = raw[i] * scale + offset;
+        }
+        break;
+    }
+    case MBRM_TYPE_INT32:
+    {
+        const int32_t *raw = (const int32_t *)pcmd->data;
+        for (i = 0; i < num; i++)
+        {
+            value[i] = (mbrm_value_t)raw[i] * scale + offset;
+        }
+        break;
+    }
+    case MBRM_TYPE_32:
+    case MBRM_TYPE_UINT32:
+    {
+        const uint32_t *raw = (const uint32_t *)pcmd->data;
+        for (i = 0; i < num; i++)
+        {
+            value[i] = (mbrm_value_t)raw[i] * scale + offset;
+        }
+        break;
+    }
+    case MBRM_TYPE_FLOAT32:
+    {
+        const float *raw = (const float *)pcmd->data;
+        for (i = 0; i < num; i++)
+        {
+            value[i] = raw[i] * scale + offset;
+        }
+        break;
+    }
+    case MBRM_TYPE_FLOAT64:
+    {
+        const double *raw = (const double *)pcmd->data;
+        for (i = 0; i < num; i++)
+        {
+            value[i] = (mbrm_value_t)(raw[i] * scale + offset);
+        }
+        break;
+    }
+    case MBRM_TYPE_INT64:
+    {
+        const int64_t *raw = (const int64_t *)pcmd->data;
+        for (i = 0; i < num; i++)
+        {
+            value[i] = (mbrm_value_t)raw[i] * scale + offset;
+        }
+        break;
+    }
+    default:
+    {
+        const uint16_t *raw = (const uint16_t *)pcmd->data;
+        for (i = 0; i < num; i++)
+        {
+            value[i] = raw[i] * scale + offset;
+        }
+        break;
+    }
+    }
+}
+
+/**
+ * @brief
+ * @param pcmd
+ * @param buf
+ * @param i
+ * @return Element i of a decoded block.
+ */
+static double _mbrm_dev_elem_value(const mbrm_device_cmd_t *pcmd, const uint8_t *buf, uint16_t i)
+{
+    union
     {
-        mbrm_device_t *pdev = mbrm_dev_priv->devs;
-        do
+        int16_t i16;
+        uint16_t u16;
+        int32_t i32;
+        uint32_t u32;
+        float f32;
+        double f64;
+        int64_t i64;
+    } v;
+
+    memcpy(&v, buf + i * _mbrm_dev_type_size(pcmd->type), _mbrm_dev_type_size(pcmd->type));
+    switch (pcmd->type)
+    {
+    case MBRM_TYPE_INT16:
+        return v.i16;
+    case MBRM_TYPE_32:
+    case MBRM_TYPE_UINT32:
+        return v.u32;
+    case MBRM_TYPE_INT32:
+        return v.i32;
+    case MBRM_TYPE_FLOAT32:
+        return v.f32;
+    case MBRM_TYPE_FLOAT64:
+        return v.f64;
+    case MBRM_TYPE_INT64:
+        return (double)v.i64;
+    default:
+        return v.u16;
+    }
+}
+
+/**
+ * @brief Mark the elements that differ, one branchless compare per element.
+ * @param now
+ * @param last
+ * @param size Bytes of one element.
+ * @param num
+ * @param changed Bitmap of (num + 31) / 32 words, may be NULL.
+ * @return Number of changed elements.
+ */
+static uint16_t _mbrm_dev_diff(const void *now, const void *last, uint8_t size, uint16_t num, uint32_t *changed)
+{
+    uint16_t i, j, n, count = 0;
+    uint32_t bits;
+
+    for (i = 0; i < num; i += 32)
+    {
+        n = (num - i < 32) ? num - i : 32;
+        bits = 0;
+        switch (size)
         {
-            if (strncmp(pdev->info.name, info->name, MBRM_DEVICE_NAME_LENTH) == 0)
+        case 2:
+            for (j = 0; j < n; j++)
             {
-                mbrm_log_w("device_detach: Target already exists.\r\n");
-                return 1;
+                bits |= (uint32_t)(((const uint16_t *)now)[i + j] != ((const uint16_t *)last)[i + j]) << j;
             }
-            pdev = pdev->next;
+            break;
+        case 4:
+            for (j = 0; j < n; j++)
+            {
+                bits |= (uint32_t)(((const uint32_t *)now)[i + j] != ((const uint32_t *)last)[i + j]) << j;
+            }
+            break;
+        default:
+            for (j = 0; j < n; j++)
+            {
+                bits |= (uint32_t)(((const uint64_t *)now)[i + j] != ((const uint64_t *)last)[i + j]) << j;
+            }
+            break;
         }
-        while (pdev != mbrm_dev_priv->devs);
+        if (changed != NULL)
+        {
+            changed[i / 32] = bits;
+        }
+        count += __builtin_popcount(bits);
     }
-
-    return mbrm_dev_priv->insert(info);
+    return count;
 }
 
-static void _mbrm_dev_pop_sigingal(uint8_t poped)
+/**
+ * @brief Compare the decoded block against the last reported one.
+ * @param pcmd
+ * @return Number of changed elements.
+ */
+static uint16_t _mbrm_dev_filter(mbrm_device_cmd_t *pcmd)
 {
-    const mbrm_communication_unit_t *unit = mbrm_dev.protocol->get_unit_in_queue(poped);
-    mbrm_device_cmd_info_t *cmd_info = (mbrm_device_cmd_info_t *)unit->cfg.user_param;
-    int i = 0;
-    uint8_t *read_data = (uint8_t *)cmd_info->pcmd->data;
+    const uint8_t *now = (const uint8_t *)pcmd->data;
+    uint8_t *last = (uint8_t *)pcmd->last;
+    uint8_t size = _mbrm_dev_type_size(pcmd->type);
+    uint16_t words = (pcmd->num + 31) / 32;
+    uint16_t changed = 0;
+    uint16_t i;
+    double diff, limit;
 
-    if (cmd_info->pcmd->cmd != 0x03 || unit->status != MBRM_QUEUE_STATUS_FINISH)
+    if (pcmd->changed != NULL)
     {
-        goto complete;
+        memset(pcmd->changed, 0, words * sizeof(uint32_t));
+    }
+    /* Unchanged scans are the common case, memcmp is the fastest way out. */
+    if (memcmp(now, last, pcmd->num * size) == 0)
+    {
+        return 0;
     }
 
-    /* cmd_info->pcmd->cmd == 0x03 && unit->status == MBRM_QUEUE_STATUS_FINISH */
-    if (cmd_info->pcmd->type == MBRM_TYPE_16)
+    if (pcmd->filter == MBRM_FILTER_CHANGE)
     {
-        mbrm_device_u16_t *data_16 = (mbrm_device_u16_t *)unit->cfg.data;
+        changed = _mbrm_dev_diff(now, last, size, pcmd->num, pcmd->changed);
+        memcpy(last, now, pcmd->num * size);
+        return changed;
+    }
+
+    for (i = 0; i < pcmd->num; i++)
+    {
+        if (memcmp(now + i * size, last + i * size, size) == 0)
+        {
+            continue;
+        }
+        diff = _mbrm_dev_elem_value(pcmd, now, i) - _mbrm_dev_elem_value(pcmd, last, i);
+        diff = (diff < 0) ? -diff : diff;
+        limit = pcmd->deadband;
+        if (pcmd->filter == MBRM_FILTER_DEADBAND_PCT)
+        {
+            limit = _mbrm_dev_elem_value(pcmd, last, i);
+            limit = ((limit < 0) ? -limit : limit) * pcmd->deadband / 100;
+        }
+        if (diff <= limit)
+        {
+            continue;
+        }
+        /* Only reported values move last, so slow drifts are caught too. */
+        memcpy(last + i * size, now + i * size, size);
+        if (pcmd->changed != NULL)
+        {
+            pcmd->changed[i / 32] |= 1UL << (i % 32);
+        }
+        changed++;
+    }
+    return changed;
+}
+
+/**
+ * @brief Decode the answer in cmd_info->buf into the command, shared by the
+ *        pop signal and dev_feed.
+ * @param cmd_info
+ * @return 1: Notify the user; 0: Filtered out.
+ */
+static uint8_t _mbrm_dev_decode(mbrm_device_cmd_info_t *cmd_info)
+{
+    int i = 0;
+    uint8_t notify = 1;
+    uint8_t *read_data = (uint8_t *)cmd_info->pcmd->data;
+
+    if (_mbrm_dev_type_size(cmd_info->pcmd->type) == 2)
+    {
+        mbrm_device_u16_t *data_16 = (mbrm_device_u16_t *)cmd_info->buf;
         switch (cmd_info->pdev->info.mode_16)
         {
         case MBRM_DEV_16_12:
@@ -181,15 +651,15 @@ static void _mbrm_dev_pop_sigingal(uint8_t poped)
             }
             break;
         case MBRM_DEV_16_21:
-            memcpy(cmd_info->pcmd->data, unit->cfg.data, 2 * cmd_info->pcmd->num);
+            memcpy(cmd_info->pcmd->data, cmd_info->buf, 2 * cmd_info->pcmd->num);
             break;
         default:
             break;
         }
     }
-    else if (cmd_info->pcmd->type == MBRM_TYPE_32)
+    else if (_mbrm_dev_type_size(cmd_info->pcmd->type) == 4)
     {
-        mbrm_device_u32_t *data_32 = (mbrm_device_u32_t *)unit->cfg.data;
+        mbrm_device_u32_t *data_32 = (mbrm_device_u32_t *)cmd_info->buf;
         switch (cmd_info->pdev->info.mode_32)
         {
         case MBRM_DEV_32_1234:
@@ -223,15 +693,74 @@ static void _mbrm_dev_pop_sigingal(uint8_t poped)
             }
             break;
         case MBRM_DEV_32_4321:
-            memcpy(cmd_info->pcmd->data, unit->cfg.data, 4 * cmd_info->pcmd->num);
+            memcpy(cmd_info->pcmd->data, cmd_info->buf, 4 * cmd_info->pcmd->num);
             break;
         default:
             break;
         }
     }
+    else
+    {
+        uint8_t pos[8];
+
+        for (i = 0; i < 8; i++)
+        {
+            pos[i] = _mbrm_dev_pos_64(cmd_info->pdev->info.mode_32, i);
+        }
+        /* Locals, the byte stores below would otherwise reload cmd_info. */
+        const uint8_t *buf = cmd_info->buf;
+        uint16_t num = cmd_info->pcmd->num;
+
+        for (i = 0; i < num; i++)
+        {
+            const uint8_t *src = buf + i * 8;
+            uint64_t v = (uint64_t)src[pos[0]] | (uint64_t)src[pos[1]] << 8 |
+                         (uint64_t)src[pos[2]] << 16 | (uint64_t)src[pos[3]] << 24 |
+                         (uint64_t)src[pos[4]] << 32 | (uint64_t)src[pos[5]] << 40 |
+                         (uint64_t)src[pos[6]] << 48 | (uint64_t)src[pos[7]] << 56;
+
+            memcpy(read_data + i * 8, &v, 8);
+        }
+    }
+
+    if (cmd_info->pcmd->value != NULL)
+    {
+        _mbrm_dev_convert(cmd_info->pcmd);
+    }
+
+#if MBRM_SHM_SWITCH
+    mbrm_get_shm()->publish(_mbrm_dev_ctx()->bus_id, cmd_info->pdev->info.name,
+                            cmd_info->pcmd - cmd_info->pdev->info.cmd_list, cmd_info->pcmd->type,
+                            cmd_info->pcmd->num, cmd_info->pcmd->data,
+                            cmd_info->pcmd->num * _mbrm_dev_type_size(cmd_info->pcmd->type));
+#endif
+
+    if (cmd_info->pcmd->filter != MBRM_FILTER_NONE && cmd_info->pcmd->last != NULL)
+    {
+        notify = (_mbrm_dev_filter(cmd_info->pcmd) != 0);
+    }
+
+    return notify;
+}
+
+/**
+ * @brief Decode and report a command once all of its parts popped.
+ * @param cmd_info Freed on return.
+ */
+static void _mbrm_dev_complete(mbrm_device_cmd_info_t *cmd_info)
+{
+    uint8_t notify = 1;
+    mbrm_queue_status_t status = cmd_info->status;
+
+    if (cmd_info->pcmd->cmd != 0x03 || status != MBRM_QUEUE_STATUS_FINISH)
+    {
+        goto complete;
+    }
+
+    notify = _mbrm_dev_decode(cmd_info);
 
 complete:
-    switch (unit->status)
+    switch (status)
     {
     case MBRM_QUEUE_STATUS_FINISH:
         mbrm_log_i("MBRM_QUEUE_STATUS_FINISH\r\n");
@@ -242,22 +771,83 @@ complete:
     case MBRM_QUEUE_STATUS_ERROR:
         mbrm_log_w("MBRM_QUEUE_STATUS_ERROR\r\n");
         break;
+    case MBRM_QUEUE_STATUS_CANCEL:
+        mbrm_log_i("MBRM_QUEUE_STATUS_CANCEL\r\n");
+        break;
+    case MBRM_QUEUE_STATUS_EXPIRED:
+        mbrm_log_w("MBRM_QUEUE_STATUS_EXPIRED\r\n");
+        break;
 
     default:
         break;
     }
 
-    if (cmd_info->complete_cb != NULL)
+    /* The filter only spares the poll callback, a request always completes. */
+    if (notify && cmd_info->complete_cb != NULL)
     {
-        cmd_info->complete_cb(unit->status, cmd_info->pcmd->data);
+        cmd_info->complete_cb(status, cmd_info->pcmd->data);
         cmd_info->complete_cb = NULL;
     }
-    mbrm_dev_priv->free_hock(unit->cfg.data);
-    mbrm_dev_priv->free_hock(cmd_info);
+    if (cmd_info->complete_ex != NULL)
+    {
+        cmd_info->complete_ex(status, cmd_info->pcmd->data, cmd_info->user_param);
+        cmd_info->complete_ex = NULL;
+    }
+    _mbrm_dev_free(MBRM_MEM_SITE_PAYLOAD, cmd_info->buf, cmd_info->buf_len);
+    __atomic_sub_fetch(&cmd_info->pdev->refs, 1, __ATOMIC_ACQ_REL);
+    _mbrm_dev_free(MBRM_MEM_SITE_CMD_INFO, cmd_info, sizeof(mbrm_device_cmd_info_t));
+}
+
+static void _mbrm_dev_pop_sigingal(uint8_t poped)
+{
+    const mbrm_communication_unit_t *unit = mbrm_dev.protocol->get_unit_in_queue(poped);
+    mbrm_device_cmd_info_t *cmd_info = (mbrm_device_cmd_info_t *)unit->cfg.user_param;
+    mbrm_queue_status_t status = unit->status;
+
+    /* Split command, wait for the last part and report the first failure. */
+    if (status != MBRM_QUEUE_STATUS_FINISH && cmd_info->status == MBRM_QUEUE_STATUS_FINISH)
+    {
+        cmd_info->status = status;
+    }
+    if (__atomic_sub_fetch(&cmd_info->parts, 1, __ATOMIC_ACQ_REL) > 0)
+    {
+        return;
+    }
+    _mbrm_dev_complete(cmd_info);
 }
 
-static void _mbrm_dev_send_protocol(mbrm_device_cmd_info_t *cmd_info)
+/**
+ * @brief Cached 0x03 request of a command, only while the command still
+ *        matches the frame built at registration.
+ * @param pdev
+ * @param pcmd
+ * @param len Registers read.
+ * @return Frame; NULL: Encoded on send.
+ */
+static const uint8_t *_mbrm_dev_read_frame(mbrm_device_t *pdev, mbrm_device_cmd_t *pcmd, uint8_t len)
+{
+    uint8_t head[6] =
+    {
+        pdev->info.slave_addr, 0x03, pcmd->register_addr >> 8, pcmd->register_addr & 0xff, 0, len,
+    };
+    const uint8_t *frame;
+
+    if (pdev->frames == NULL || pcmd < pdev->info.cmd_list || pcmd >= pdev->info.cmd_list + pdev->info.cmd_num)
+    {
+        return NULL;
+    }
+    frame = pdev->frames[pcmd - pdev->info.cmd_list];
+    return (memcmp(frame, head, sizeof(head)) == 0) ? frame : NULL;
+}
+/**
+ * @brief
+ * @param cmd_info
+ * @param handle Id of the queued unit, may be NULL.
+ * @return 0 Succeed; 2: Memory alloc fail; 3: Queue is full.
+ */
+static int _mbrm_dev_send_protocol(mbrm_device_cmd_info_t *cmd_info, uint32_t *handle)
 {
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
     uint8_t *buf = NULL;
     mbrm_device_t *pdev = cmd_info->pdev;
     mbrm_device_cmd_t *pcmd = cmd_info->pcmd;
@@ -265,9 +855,15 @@ static void _mbrm_dev_send_protocol(mbrm_device_cmd_info_t *cmd_info)
     switch (pcmd->type)
     {
     case MBRM_TYPE_16:
+    case MBRM_TYPE_INT16:
+    case MBRM_TYPE_UINT16:
         mbrm_dev_priv->send_len = pcmd->num;
         mbrm_device_u16_t *send_data16 = (mbrm_device_u16_t *)pcmd->data;
-        buf = (uint8_t *)mbrm_dev_priv->malloc_hock(2 * mbrm_dev_priv->send_len);
+        buf = (uint8_t *)_mbrm_dev_malloc(MBRM_MEM_SITE_PAYLOAD, 2 * mbrm_dev_priv->send_len);
+        if (buf == NULL)
+        {
+            break;
+        }
 
         for (size_t i = 0; i < pcmd->num; i++)
         {
@@ -289,9 +885,16 @@ static void _mbrm_dev_send_protocol(mbrm_device_cmd_info_t *cmd_info)
         break;
 
     case MBRM_TYPE_32:
+    case MBRM_TYPE_INT32:
+    case MBRM_TYPE_UINT32:
+    case MBRM_TYPE_FLOAT32:
         mbrm_dev_priv->send_len = 2 * pcmd->num;
         mbrm_device_u32_t *send_data32 = (mbrm_device_u32_t *)pcmd->data;
-        buf = (uint8_t *)mbrm_dev_priv->malloc_hock(2 * mbrm_dev_priv->send_len);
+        buf = (uint8_t *)_mbrm_dev_malloc(MBRM_MEM_SITE_PAYLOAD, 2 * mbrm_dev_priv->send_len);
+        if (buf == NULL)
+        {
+            break;
+        }
 
         for (size_t i = 0; i < pcmd->num; i++)
         {
@@ -329,72 +932,220 @@ static void _mbrm_dev_send_protocol(mbrm_device_cmd_info_t *cmd_info)
         }
         break;
 
+    case MBRM_TYPE_FLOAT64:
+    case MBRM_TYPE_INT64:
+        mbrm_dev_priv->send_len = 4 * pcmd->num;
+        uint8_t *send_data64 = (uint8_t *)pcmd->data;
+        buf = (uint8_t *)_mbrm_dev_malloc(MBRM_MEM_SITE_PAYLOAD, 2 * mbrm_dev_priv->send_len);
+        if (buf == NULL)
+        {
+            break;
+        }
+
+        uint8_t pos[8];
+
+        for (size_t i = 0; i < 8; i++)
+        {
+            pos[i] = _mbrm_dev_pos_64(pdev->info.mode_32, i);
+        }
+        for (size_t i = 0; i < pcmd->num * 8u; i++)
+        {
+            buf[(i & ~7u) + pos[i & 7]] = send_data64[i];
+        }
+        break;
+
     default:
         break;
     }
+    if (buf == NULL)
+    {
+        mbrm_log_e("Memory alloc fail.\r\n");
+        return 2;
+    }
 
-    mbrm_unit_cfg_t cfg =
+    /* Split blocks larger than the slave accepts, never inside an element. */
+    uint16_t total = mbrm_dev_priv->send_len;
+    uint16_t step = total;
+    uint8_t limit = 0;
+    uint8_t elem = _mbrm_dev_type_size(pcmd->type) / 2;
+    uint8_t parts, k;
+    const uint8_t *frame = NULL;
+
+    if (pcmd->cmd == 0x03)
     {
-        .cmd = pcmd->cmd,
-        .slave_addr = pdev->info.slave_addr,
-        .register_addr = pcmd->register_addr,
-        .data = buf,
-        .len = mbrm_dev_priv->send_len,
-        .repeat_max = pdev->info.repeat_max,
-        .over_time = pdev->info.over_time,
-        .pop_sigingal = mbrm_dev_priv->pop_sigingal,
-        .user_param = cmd_info,
-    };
-    mbrm_dev.protocol->send_cmd(&cfg);
+        limit = pdev->info.caps.max_read;
+    }
+    else if (pcmd->cmd == 0x10)
+    {
+        limit = pdev->info.caps.max_write;
+    }
+    if (limit != 0 && limit < total)
+    {
+        step = (limit < elem) ? elem : limit - limit % elem;
+    }
+    parts = (total + step - 1) / step;
+    if (parts > mbrm_dev.protocol->get_free())
+    {
+        mbrm_log_w("Queue is full.\r\n");
+        _mbrm_dev_free(MBRM_MEM_SITE_PAYLOAD, buf, 2 * total);
+        return 3;
+    }
+    cmd_info->buf = buf;
+    cmd_info->buf_len = 2 * total;
+    cmd_info->parts = parts;
+    cmd_info->status = MBRM_QUEUE_STATUS_FINISH;
+
+    if (pcmd->cmd == 0x03 && parts == 1)
+    {
+        frame = _mbrm_dev_read_frame(pdev, pcmd, total);
+    }
+
+    for (k = 0; k < parts; k++)
+    {
+        mbrm_unit_cfg_t cfg =
+        {
+            .cmd = pcmd->cmd,
+            .slave_addr = pdev->info.slave_addr,
+            .register_addr = pcmd->register_addr + k * step,
+            .data = buf + k * step * 2,
+            .len = (total - k * step < step) ? total - k * step : step,
+            .repeat_max = pdev->info.repeat_max,
+            .over_time = pdev->info.over_time,
+            .deadline = cmd_info->deadline,
+            .group = cmd_info->handle,
+            .frame = frame,
+            .pop_sigingal = mbrm_dev_priv->pop_sigingal,
+            .user_param = cmd_info,
+        };
+        if (mbrm_dev.protocol->send_cmd(&cfg) != 0)
+        {
+            mbrm_log_w("Queue is full.\r\n");
+            if (k == 0)
+            {
+                _mbrm_dev_free(MBRM_MEM_SITE_PAYLOAD, buf, 2 * total);
+                return 3;
+            }
+            /* The parts already queued complete the command with an error. */
+            cmd_info->status = MBRM_QUEUE_STATUS_ERROR;
+            if (__atomic_sub_fetch(&cmd_info->parts, parts - k, __ATOMIC_ACQ_REL) == 0)
+            {
+                /* They all popped while the later ones were pushed. */
+                _mbrm_dev_complete(cmd_info);
+            }
+            break;
+        }
+        if (k == 0 && parts > 1)
+        {
+            /* The first id is the group of the others, so it cancels every part. */
+            cmd_info->handle = cfg.id;
+        }
+        if (k == 0 && handle != NULL)
+        {
+            *handle = cfg.id;
+        }
+    }
+    return 0;
 }
 
 /**
  * @brief
  * @param
- * @return 0 Succeed; -1: parameter err; 1: Target not found; 2: Memory alloc fail.
+ * @return 0 Succeed; -1: parameter err; 1: Target not found; 2: Memory alloc fail; 3: Queue is full.
  */
-static int _mbrm_dev_send_cmd(char *name, int cmd, void(*complete_cb)(mbrm_queue_status_t status, void *data))
+static int _mbrm_dev_enqueue(char *name, int cmd, void(*complete_cb)(mbrm_queue_status_t status, void *data),
+                             const mbrm_device_req_t *req, uint32_t *handle)
 {
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    int ret;
+
     if (name == NULL)
     {
         mbrm_log_e("device_send_cmd: parameter err.\r\n");
         return -1;
     }
-    if (mbrm_dev_priv->devs == NULL)
+
+    _mbrm_dev_try_reclaim();
+    uint32_t e = _mbrm_dev_read_lock();
+    mbrm_device_t *pdev = _mbrm_dev_find(name);
+    if (pdev == NULL)
     {
+        _mbrm_dev_read_unlock(e);
         mbrm_log_w("device_send_cmd: Target not found.\r\n");
         return 1;
     }
 
-    mbrm_device_t *pdev = mbrm_dev_priv->devs;
-    do
+    mbrm_device_cmd_t *pcmd = &pdev->info.cmd_list[cmd];
+    mbrm_device_cmd_info_t *cmd_info = (mbrm_device_cmd_info_t *)_mbrm_dev_malloc(MBRM_MEM_SITE_CMD_INFO, sizeof(mbrm_device_cmd_info_t));
+    if (cmd_info == NULL)
     {
-        if (strncmp(pdev->info.name, name, MBRM_DEVICE_NAME_LENTH) == 0)
-        {
-            mbrm_device_cmd_t *pcmd = &pdev->info.cmd_list[cmd];
-            mbrm_device_cmd_info_t *cmd_info = (mbrm_device_cmd_info_t *)mbrm_dev_priv->malloc_hock(sizeof(mbrm_device_cmd_info_t));
-            cmd_info->pdev = pdev;
-            cmd_info->pcmd = pcmd;
-            cmd_info->complete_cb = complete_cb;
-            mbrm_dev_priv->send_protocol(cmd_info);
-
-            return 0;
-        }
-        pdev = pdev->next;
+        _mbrm_dev_read_unlock(e);
+        mbrm_log_e("Memory alloc fail.\r\n");
+        return 2;
     }
-    while (pdev != mbrm_dev_priv->devs);
+    memset(cmd_info, 0, sizeof(mbrm_device_cmd_info_t));
+    cmd_info->pdev = pdev;
+    cmd_info->pcmd = pcmd;
+    cmd_info->complete_cb = complete_cb;
+    if (req != NULL)
+    {
+        cmd_info->complete_ex = req->complete_cb;
+        cmd_info->user_param = req->user_param;
+        cmd_info->deadline = req->deadline;
+    }
+    /* The request keeps the device alive after a detach. */
+    __atomic_add_fetch(&pdev->refs, 1, __ATOMIC_ACQ_REL);
+    ret = mbrm_dev_priv->send_protocol(cmd_info, handle);
+    if (ret != 0)
+    {
+        __atomic_sub_fetch(&pdev->refs, 1, __ATOMIC_ACQ_REL);
+        _mbrm_dev_free(MBRM_MEM_SITE_CMD_INFO, cmd_info, sizeof(mbrm_device_cmd_info_t));
+    }
+    _mbrm_dev_read_unlock(e);
 
-    mbrm_log_w("device_send_cmd: Target not found.\r\n");
-    return 1;
+    return ret;
+}
+
+/**
+ * @brief
+ * @param
+ * @return 0 Succeed; -1: parameter err; 1: Target not found; 2: Memory alloc fail; 3: Queue is full.
+ */
+static int _mbrm_dev_send_cmd(char *name, int cmd, void(*complete_cb)(mbrm_queue_status_t status, void *data))
+{
+    return _mbrm_dev_enqueue(name, cmd, complete_cb, NULL, NULL);
+}
+
+/**
+ * @brief Send a command with a deadline, handle can be passed to dev_cancel.
+ * @param
+ * @return 0 Succeed; -1: parameter err; 1: Target not found; 2: Memory alloc fail; 3: Queue is full.
+ */
+static int _mbrm_dev_request(char *name, int cmd, const mbrm_device_req_t *req, uint32_t *handle)
+{
+    return _mbrm_dev_enqueue(name, cmd, NULL, req, handle);
+}
+
+/**
+ * @brief Cancelled requests complete with MBRM_QUEUE_STATUS_CANCEL, the
+ *        handle of a split command cancels all of its parts.
+ * @param handle
+ * @return 0 Succeed; 1: Target not found.
+ */
+static int _mbrm_dev_cancel(uint32_t handle)
+{
+    return mbrm_dev.protocol->cancel(handle);
 }
 
 static void _mbrm_dev_init(const mbrm_init_cfg *cfg)
 {
-    mbrm_dev_priv = (mbrm_device_class_private_t *)mbrm_dev.priv;
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
 
     mbrm_dev.protocol = mbrm_get_protocol();
     mbrm_dev.protocol->init(cfg);
 
+    mbrm_dev_priv->mutex_lock = cfg->mutex_lock;
+    mbrm_dev_priv->mutex_unlock = cfg->mutex_unlock;
+    mbrm_dev_priv->bus_id = cfg->bus_id;
     mbrm_dev_priv->insert = _mbrm_dev_insert;
     mbrm_dev_priv->remove = _mbrm_dev_remove;
     mbrm_dev_priv->send_protocol = _mbrm_dev_send_protocol;
@@ -411,6 +1162,73 @@ static void _mbrm_dev_init(const mbrm_init_cfg *cfg)
     }
 }
 
+/**
+ * @brief
+ * @param name
+ * @return Info of the registered device, valid until it is detached, use
+ *         dev_get when a detach may run meanwhile; NULL: Target not found.
+ */
+static mbrm_device_info_t *_mbrm_dev_get_info(char *name)
+{
+    mbrm_device_t *pdev;
+    uint32_t e;
+
+    if (name == NULL)
+    {
+        return NULL;
+    }
+
+    e = _mbrm_dev_read_lock();
+    pdev = _mbrm_dev_find(name);
+    _mbrm_dev_read_unlock(e);
+
+    return (pdev == NULL) ? NULL : &pdev->info;
+}
+
+/**
+ * @brief Like dev_get_info, but the device stays valid after a detach
+ *        until it is given back with dev_put.
+ * @param name
+ * @return NULL: Target not found.
+ */
+static mbrm_device_info_t *_mbrm_dev_get(char *name)
+{
+    mbrm_device_t *pdev;
+    uint32_t e;
+
+    if (name == NULL)
+    {
+        return NULL;
+    }
+
+    e = _mbrm_dev_read_lock();
+    pdev = _mbrm_dev_find(name);
+    if (pdev != NULL)
+    {
+        __atomic_add_fetch(&pdev->refs, 1, __ATOMIC_ACQ_REL);
+    }
+    _mbrm_dev_read_unlock(e);
+
+    return (pdev == NULL) ? NULL : &pdev->info;
+}
+
+/**
+ * @brief Drop the ref taken by dev_get, safe from the pop signal. A detached
+ *        device is freed by the next register, detach or send.
+ * @param info
+ */
+static void _mbrm_dev_put(mbrm_device_info_t *info)
+{
+    mbrm_device_t *pdev;
+
+    if (info == NULL)
+    {
+        return;
+    }
+    pdev = (mbrm_device_t *)((char *)info - offsetof(mbrm_device_t, info));
+    __atomic_sub_fetch(&pdev->refs, 1, __ATOMIC_ACQ_REL);
+}
+
 static int _mbrm_dev_set_data(char *name, int cmd, void *data)
 {
     if (name == NULL)
@@ -418,36 +1236,137 @@ static int _mbrm_dev_set_data(char *name, int cmd, void *data)
         mbrm_log_e("dev_set_data: parameter err.\r\n");
         return -1;
     }
-    if (mbrm_dev_priv->devs == NULL)
+
+    uint32_t e = _mbrm_dev_read_lock();
+    mbrm_device_t *pdev = _mbrm_dev_find(name);
+    if (pdev == NULL)
     {
+        _mbrm_dev_read_unlock(e);
         mbrm_log_w("dev_set_data: Target not found.\r\n");
         return 1;
     }
 
-    mbrm_device_t *pdev = mbrm_dev_priv->devs;
-    do
+    mbrm_device_cmd_t *pcmd = &pdev->info.cmd_list[cmd];
+    memcpy(pcmd->data, data, pcmd->num * _mbrm_dev_type_size(pcmd->type));
+    _mbrm_dev_read_unlock(e);
+
+    return 0;
+}
+
+/**
+ * @brief Decode registers read by someone else into every 0x03 command of
+ *        the slave that lies inside the block, no transaction is made.
+ * @param slave_addr
+ * @param register_addr First register of the block.
+ * @param data Register bytes as on the wire.
+ * @param num Registers in the block.
+ * @param complete_cb Called for each command updated and not filtered out.
+ * @return Number of commands updated; -1: Parameter err.
+ */
+static int _mbrm_dev_feed(uint8_t slave_addr, uint16_t register_addr, const uint8_t *data, uint16_t num,
+                          void (*complete_cb)(mbrm_device_info_t *info, int cmd, void *data))
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    mbrm_device_cmd_info_t cmd_info;
+    mbrm_device_t *pdev;
+    mbrm_device_cmd_t *pcmd;
+    uint32_t e;
+    uint16_t regs;
+    int c, fed = 0;
+
+    if (data == NULL)
     {
-        if (strncmp(pdev->info.name, name, MBRM_DEVICE_NAME_LENTH) == 0)
-        {
-            mbrm_device_cmd_t *pcmd = &pdev->info.cmd_list[cmd];
+        mbrm_log_e("dev_feed: Parameter err.\r\n");
+        return -1;
+    }
 
-            if (pcmd->type == MBRM_TYPE_16)
+    e = _mbrm_dev_read_lock();
+    pdev = __atomic_load_n(&mbrm_dev_priv->devs, __ATOMIC_ACQUIRE);
+    for (; pdev != NULL; pdev = __atomic_load_n(&pdev->next, __ATOMIC_ACQUIRE))
+    {
+        if (pdev->info.slave_addr != slave_addr)
+        {
+            continue;
+        }
+        for (c = 0; c < pdev->info.cmd_num; c++)
+        {
+            pcmd = &pdev->info.cmd_list[c];
+            regs = pcmd->num * _mbrm_dev_type_size(pcmd->type) / 2;
+            if (pcmd->cmd != 0x03 || pcmd->register_addr < register_addr ||
+                    pcmd->register_addr + regs > register_addr + num)
             {
-                memcpy(pcmd->data, data, pcmd->num * 2);
+                continue;
             }
-            else
+            memset(&cmd_info, 0, sizeof(cmd_info));
+            cmd_info.pdev = pdev;
+            cmd_info.pcmd = pcmd;
+            cmd_info.buf = (uint8_t *)data + (pcmd->register_addr - register_addr) * 2;
+            fed++;
+            if (_mbrm_dev_decode(&cmd_info) && complete_cb != NULL)
             {
-                memcpy(pcmd->data, data, pcmd->num * 4);
+                complete_cb(&pdev->info, c, pcmd->data);
             }
-
-            return 0;
         }
-        pdev = pdev->next;
     }
-    while (pdev != mbrm_dev_priv->devs);
+    _mbrm_dev_read_unlock(e);
+
+    return fed;
+}
 
-    mbrm_log_w("dev_set_data: Target not found.\r\n");
-    return 1;
+/**
+ * @brief Call cb for every registered device, in register order.
+ * @param cb
+ * @param arg
+ * @return Number of devices; -1: Parameter err.
+ */
+static int _mbrm_dev_foreach(void (*cb)(mbrm_device_info_t *info, void *arg), void *arg)
+{
+    mbrm_device_class_private_t *mbrm_dev_priv = _mbrm_dev_ctx();
+    mbrm_device_t *pdev;
+    uint32_t e;
+    int num = 0;
+
+    if (cb == NULL)
+    {
+        return -1;
+    }
+
+    e = _mbrm_dev_read_lock();
+    pdev = __atomic_load_n(&mbrm_dev_priv->devs, __ATOMIC_ACQUIRE);
+    for (; pdev != NULL; pdev = __atomic_load_n(&pdev->next, __ATOMIC_ACQUIRE))
+    {
+        cb(&pdev->info, arg);
+        num++;
+    }
+    _mbrm_dev_read_unlock(e);
+
+    return num;
+}
+
+/**
+ * @brief Select the bus the calling thread works on, protocol and device
+ *        layer. Later calls of the thread act on it and its callbacks run
+ *        with it selected.
+ * @param bus Zeroed until its init; NULL: The default bus.
+ * @return Bus selected before, NULL: The default bus.
+ */
+static mbrm_bus_t *_mbrm_dev_bus_select(mbrm_bus_t *bus)
+{
+    mbrm_bus_t *prev = mbrm_dev_bus;
+
+    mbrm_dev_bus = bus;
+    mbrm_get_protocol()->select((bus != NULL) ? &bus->protocol : NULL);
+    return prev;
+}
+
+/**
+ * @brief
+ * @param
+ * @return Bus selected by the calling thread, NULL: The default bus.
+ */
+static mbrm_bus_t *_mbrm_dev_bus_selected(void)
+{
+    return mbrm_dev_bus;
 }
 
 static mbrm_device_class_t mbrm_dev =
@@ -457,6 +1376,15 @@ static mbrm_device_class_t mbrm_dev =
     .dev_register = _mbrm_dev_register,
     .dev_send_cmd = _mbrm_dev_send_cmd,
     .dev_set_data = _mbrm_dev_set_data,
+    .dev_request = _mbrm_dev_request,
+    .dev_cancel = _mbrm_dev_cancel,
+    .dev_get_info = _mbrm_dev_get_info,
+    .dev_get = _mbrm_dev_get,
+    .dev_put = _mbrm_dev_put,
+    .dev_feed = _mbrm_dev_feed,
+    .dev_foreach = _mbrm_dev_foreach,
+    .bus_select = _mbrm_dev_bus_select,
+    .bus_selected = _mbrm_dev_bus_selected,
 };
 
 const mbrm_device_class_t *get_mbrm_devive_obj(void)
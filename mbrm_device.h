@@ -47,8 +47,29 @@ typedef enum
 {
     MBRM_TYPE_16 = 0,
     MBRM_TYPE_32,
+    MBRM_TYPE_INT16,
+    MBRM_TYPE_UINT16,
+    MBRM_TYPE_INT32,
+    MBRM_TYPE_UINT32,
+    MBRM_TYPE_FLOAT32,
+    MBRM_TYPE_FLOAT64,
+    MBRM_TYPE_INT64,
 } mbrm_device_type_t;
 
+#if MBRM_VALUE_DOUBLE
+typedef double mbrm_value_t;
+#else
+typedef float mbrm_value_t;
+#endif
+
+typedef enum
+{
+    MBRM_FILTER_NONE = 0,
+    MBRM_FILTER_CHANGE,
+    MBRM_FILTER_DEADBAND_ABS,
+    MBRM_FILTER_DEADBAND_PCT,
+} mbrm_device_filter_t;
+
 typedef union
 {
     uint8_t data8[2];
@@ -68,8 +89,45 @@ typedef struct
     uint16_t num;
     mbrm_device_type_t type;
     void *data;
+
+    /**
+     * Engineering output, value[i] = data[i] * scale + offset (scale 0 means 1).
+     * 64 bit types use the word and byte order of mode_32.
+     */
+    mbrm_value_t *value;
+    mbrm_value_t scale;
+    mbrm_value_t offset;
+
+    /**
+     * Read filter. complete_cb is only called when an element changed, beyond
+     * deadband for the deadband modes, dev_request completions always run.
+     * last keeps the last reported block (same size as data, initialised by
+     * the user), changed is an optional bitmap of (num + 31) / 32 words
+     * marking the changed elements.
+     */
+    mbrm_device_filter_t filter;
+    float deadband;
+    void *last;
+    uint32_t *changed;
+
+    /* Poll period the application needs, checked by the planner(0: None). */
+    uint32_t period_ms;
 } mbrm_device_cmd_t;
 
+#define MBRM_FUNC_03 0x01
+#define MBRM_FUNC_06 0x02
+#define MBRM_FUNC_10 0x04
+
+typedef struct
+{
+    uint8_t probed;
+    /* Largest block accepted, 0: Unlimited. Larger commands are split. */
+    uint8_t max_read;
+    uint8_t max_write;
+    /* MBRM_FUNC_xx flags of the function codes the slave answers. */
+    uint8_t func;
+} mbrm_device_caps_t;
+
 typedef struct
 {
     char name[MBRM_DEVICE_NAME_LENTH];
@@ -80,34 +138,84 @@ typedef struct
     mbrm_device_16_mode_t mode_16;
     mbrm_device_32_mode_t mode_32;
     mbrm_device_cmd_t *cmd_list;
+    /* Commands in cmd_list, only needed by dev_feed(0: None fed). */
+    uint8_t cmd_num;
+    mbrm_device_caps_t caps;
 } mbrm_device_info_t;
 
 typedef struct mbrm_device
 {
     mbrm_device_info_t info;
-    struct mbrm_device *prev;
+    /* Requests in flight and dev_get refs, a detached device is freed after they are gone. */
+    uint32_t refs;
+    /* Epoch of the detach. */
+    uint32_t retire;
+    /* Encoded 0x03 requests of cmd_list, built at registration and only read after(NULL: No cmd_num). */
+    uint8_t (*frames)[8];
     struct mbrm_device *next;
+    struct mbrm_device *retired_next;
 } mbrm_device_t;
 
+typedef struct
+{
+    /* Absolute time on get_time_us after which the request is dropped, 0: none. */
+    uint32_t deadline;
+    void(*complete_cb)(mbrm_queue_status_t status, void *data, void *user_param);
+    void *user_param;
+} mbrm_device_req_t;
+
 typedef struct
 {
     mbrm_device_t *pdev;
     mbrm_device_cmd_t *pcmd;
     void(*complete_cb)(mbrm_queue_status_t status, void *data);
+    void(*complete_ex)(mbrm_queue_status_t status, void *data, void *user_param);
+    void *user_param;
+    uint32_t deadline;
+    uint8_t *buf;
+    uint16_t buf_len;
+    /* Parts still queued, the command completes when the last one pops. */
+    uint8_t parts;
+    mbrm_queue_status_t status;
+    /* Id of the first part of a split command, cancels all of them(0: Not split). */
+    uint32_t handle;
 } mbrm_device_cmd_info_t;
 
 typedef struct
 {
     uint8_t send_len;
+    /**
+     * NULL terminated, readers walk it without a lock. Writers are serialised
+     * by the mutex given to init, a detached device is freed two epochs later
+     * once its requests and dev_get refs are gone.
+     */
     mbrm_device_t *devs;
+    mbrm_device_t *retired;
+    uint32_t epoch;
+    uint32_t active[2];
+    void (*mutex_lock)(void);
+    void (*mutex_unlock)(void);
     int (*insert)(mbrm_device_info_t *info);
     void (*remove)(mbrm_device_t *p);
     void (*pop_sigingal)(uint8_t poped);
-    void (*send_protocol)(mbrm_device_cmd_info_t *cmd_info);
+    int (*send_protocol)(mbrm_device_cmd_info_t *cmd_info, uint32_t *handle);
     void *(*malloc_hock)(size_t size);
     void (*free_hock)(void *ptr);
+    uint16_t bus_id;
 } mbrm_device_class_private_t;
 
+/**
+ * State of one bus. Any number of them run beside the default bus, each is
+ * selected with bus_select before its init and before every call on it.
+ * Probe, scan and the other layers on top keep one instance and act on the
+ * bus selected when they are called.
+ */
+typedef struct
+{
+    mbrm_protocol_private_t protocol;
+    mbrm_device_class_private_t device;
+} mbrm_bus_t;
+
 typedef struct
 {
     /* PRIVATE */
@@ -120,6 +228,16 @@ typedef struct
     int (*dev_detach)(char *name);
     int (*dev_send_cmd)(char *name, int cmd, void(*complete_cb)(mbrm_queue_status_t status, void *data));
     int (*dev_set_data)(char *name, int cmd, void *data);
+    int (*dev_request)(char *name, int cmd, const mbrm_device_req_t *req, uint32_t *handle);
+    int (*dev_cancel)(uint32_t handle);
+    mbrm_device_info_t *(*dev_get_info)(char *name);
+    mbrm_device_info_t *(*dev_get)(char *name);
+    void (*dev_put)(mbrm_device_info_t *info);
+    int (*dev_feed)(uint8_t slave_addr, uint16_t register_addr, const uint8_t *data, uint16_t num,
+                    void (*complete_cb)(mbrm_device_info_t *info, int cmd, void *data));
+    int (*dev_foreach)(void (*cb)(mbrm_device_info_t *info, void *arg), void *arg);
+    mbrm_bus_t *(*bus_select)(mbrm_bus_t *bus);
+    mbrm_bus_t *(*bus_selected)(void);
 } mbrm_device_class_t;
 
 const mbrm_device_class_t *get_mbrm_devive_obj(void);
@@ -0,0 +1,756 @@
+/*
+ * mbrm_gateway.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+#include "mbrm_gateway.h"
+
+#if MBRM_GATEWAY_SWITCH
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/* Exception codes sent back to clients. */
+#define MBRM_GATEWAY_EX_ILLEGAL_FUNCTION 0x01
+#define MBRM_GATEWAY_EX_ILLEGAL_VALUE 0x03
+#define MBRM_GATEWAY_EX_BUSY 0x06
+#define MBRM_GATEWAY_EX_NO_RESPONSE 0x0B
+
+/* epoll data of the listening socket and of the serial fd. */
+#define MBRM_GATEWAY_EV_LISTEN 0xFFFF
+#define MBRM_GATEWAY_EV_SERIAL 0xFFFE
+
+static mbrm_gateway_t mbrm_gateway;
+static mbrm_gateway_private_t *mbrm_gw_priv;
+
+static void _mbrm_gw_pop_sigingal(uint8_t poped);
+
+/**
+ * @brief
+ * @param fd
+ * @return 0 Succeed; other: Fail.
+ */
+static int _mbrm_gw_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * @brief
+ * @param client
+ * @param events
+ */
+static void _mbrm_gw_watch(uint8_t client, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.u64 = client;
+    epoll_ctl(mbrm_gw_priv->epfd, EPOLL_CTL_MOD, mbrm_gw_priv->clients[client].fd, &ev);
+}
+
+/**
+ * @brief Send what is left of the replies of a client, EPOLLOUT is watched
+ *        while bytes remain.
+ * @param client
+ */
+static void _mbrm_gw_flush(uint8_t client)
+{
+    mbrm_gateway_client_t *c = &mbrm_gw_priv->clients[client];
+    ssize_t n;
+
+    while (c->tx_len > 0)
+    {
+        n = send(c->fd, c->tx_buf, c->tx_len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            c->closing = 1;
+            return;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        c->tx_len -= n;
+        memmove(c->tx_buf, c->tx_buf + n, c->tx_len);
+    }
+    _mbrm_gw_watch(client, (c->tx_len > 0) ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+}
+
+/**
+ * @brief Send an MBAP frame. The part the socket does not take is kept for
+ *        EPOLLOUT, a client too far behind is closed at the end of the poll.
+ * @param client
+ * @param tid
+ * @param unit
+ * @param pdu
+ * @param len
+ */
+static void _mbrm_gw_reply(uint8_t client, uint16_t tid, uint8_t unit, const uint8_t *pdu, uint16_t len)
+{
+    mbrm_gateway_client_t *c = &mbrm_gw_priv->clients[client];
+    uint8_t buf[7 + 253];
+    uint8_t queued = (c->tx_len > 0);
+    ssize_t n = 0;
+
+    if (c->fd < 0 || c->closing)
+    {
+        return;
+    }
+    buf[0] = tid >> 8;
+    buf[1] = tid & 0xff;
+    buf[2] = 0;
+    buf[3] = 0;
+    buf[4] = (len + 1) >> 8;
+    buf[5] = (len + 1) & 0xff;
+    buf[6] = unit;
+    memcpy(buf + 7, pdu, len);
+    len += 7;
+
+    /* Replies already waiting go first. */
+    if (!queued)
+    {
+        n = send(c->fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            c->closing = 1;
+            return;
+        }
+        n = (n < 0) ? 0 : n;
+        if (n == len)
+        {
+            return;
+        }
+    }
+    if ((size_t)(c->tx_len + len - n) > sizeof(c->tx_buf))
+    {
+        mbrm_log_w("gateway: Client %d is not reading.\r\n", client);
+        c->closing = 1;
+        return;
+    }
+    memcpy(c->tx_buf + c->tx_len, buf + n, len - n);
+    c->tx_len += len - n;
+    if (!queued)
+    {
+        _mbrm_gw_watch(client, EPOLLIN | EPOLLOUT);
+    }
+}
+
+/**
+ * @brief
+ * @param client
+ * @param tid
+ * @param unit
+ * @param fc
+ * @param code
+ */
+static void _mbrm_gw_exception(uint8_t client, uint16_t tid, uint8_t unit, uint8_t fc, uint8_t code)
+{
+    uint8_t pdu[2] = {fc | 0x80, code};
+
+    mbrm_gw_priv->stat.exceptions++;
+    _mbrm_gw_reply(client, tid, unit, pdu, 2);
+}
+
+/**
+ * @brief Move waiting transactions onto the RTU queue, taking clients in
+ *        turn so a busy client cannot starve the others.
+ * @param
+ */
+static void _mbrm_gw_dispatch(void)
+{
+    mbrm_gateway_trans_t *pick, *t;
+    uint8_t n, c, i;
+
+    while (mbrm_gw_priv->on_bus < MBRM_GATEWAY_BUS_DEPTH && mbrm_gw_priv->protocol->get_free() > 0)
+    {
+        pick = NULL;
+        for (n = 0; n < MBRM_GATEWAY_CLIENT_MAX && pick == NULL; n++)
+        {
+            c = (mbrm_gw_priv->rr + n) % MBRM_GATEWAY_CLIENT_MAX;
+            if (mbrm_gw_priv->clients[c].waiting == 0)
+            {
+                continue;
+            }
+            /* Oldest transaction of this client. */
+            for (i = 0; i < MBRM_GATEWAY_TRANS_MAX; i++)
+            {
+                t = &mbrm_gw_priv->trans[i];
+                if (t->state == MBRM_GATEWAY_TRANS_WAIT && t->owner == c && (pick == NULL || t->seq < pick->seq))
+                {
+                    pick = t;
+                }
+            }
+        }
+        if (pick == NULL)
+        {
+            return;
+        }
+        mbrm_gw_priv->rr = (pick->owner + 1) % MBRM_GATEWAY_CLIENT_MAX;
+
+        mbrm_unit_cfg_t cfg =
+        {
+            .cmd = pick->fc,
+            .slave_addr = pick->unit,
+            .register_addr = pick->addr,
+            .len = pick->qty,
+            .repeat_max = mbrm_gw_priv->cfg.repeat_max,
+            .over_time = mbrm_gw_priv->cfg.over_time,
+            .data = pick->data,
+            .pop_sigingal = _mbrm_gw_pop_sigingal,
+            .user_param = pick,
+        };
+        if (mbrm_gw_priv->protocol->send_cmd(&cfg) != 0)
+        {
+            return;
+        }
+        pick->id = cfg.id;
+        pick->state = MBRM_GATEWAY_TRANS_BUS;
+        mbrm_gw_priv->clients[pick->owner].waiting--;
+        mbrm_gw_priv->on_bus++;
+        mbrm_gw_priv->stat.bus_transactions++;
+    }
+}
+
+/**
+ * @brief Answer every client waiting on the transaction.
+ * @param poped
+ */
+static void _mbrm_gw_pop_sigingal(uint8_t poped)
+{
+    const mbrm_communication_unit_t *unit = mbrm_gw_priv->protocol->get_unit_in_queue(poped);
+    mbrm_gateway_trans_t *t = (mbrm_gateway_trans_t *)unit->cfg.user_param;
+    uint8_t pdu[253];
+    uint16_t len = 0;
+    uint8_t i;
+
+    switch (unit->status)
+    {
+    case MBRM_QUEUE_STATUS_FINISH:
+        pdu[0] = t->fc;
+        if (t->fc == 0x03)
+        {
+            pdu[1] = t->qty * 2;
+            memcpy(pdu + 2, t->data, t->qty * 2);
+            len = 2 + t->qty * 2;
+        }
+        else
+        {
+            pdu[1] = t->addr >> 8;
+            pdu[2] = t->addr & 0xff;
+            pdu[3] = (t->fc == 0x06) ? t->data[0] : t->qty >> 8;
+            pdu[4] = (t->fc == 0x06) ? t->data[1] : t->qty & 0xff;
+            len = 5;
+        }
+        break;
+
+    case MBRM_QUEUE_STATUS_ERROR:
+        pdu[0] = t->fc | 0x80;
+        pdu[1] = (unit->exception != 0) ? unit->exception : MBRM_GATEWAY_EX_NO_RESPONSE;
+        len = 2;
+        break;
+
+    default:
+        pdu[0] = t->fc | 0x80;
+        pdu[1] = MBRM_GATEWAY_EX_NO_RESPONSE;
+        len = 2;
+        break;
+    }
+
+    for (i = 0; i < t->waiter_num; i++)
+    {
+        if (len == 2)
+        {
+            mbrm_gw_priv->stat.exceptions++;
+        }
+        _mbrm_gw_reply(t->waiters[i].client, t->waiters[i].tid, t->unit, pdu, len);
+    }
+    t->state = MBRM_GATEWAY_TRANS_FREE;
+    mbrm_gw_priv->on_bus--;
+
+    _mbrm_gw_dispatch();
+}
+
+/**
+ * @brief
+ * @param client
+ * @param tid
+ * @param t
+ * @return 0 Succeed; 1: Too many waiters.
+ */
+static int _mbrm_gw_add_waiter(uint8_t client, uint16_t tid, mbrm_gateway_trans_t *t)
+{
+    if (t->waiter_num >= MBRM_GATEWAY_WAITER_MAX)
+    {
+        return 1;
+    }
+    t->waiters[t->waiter_num].client = client;
+    t->waiters[t->waiter_num].tid = tid;
+    t->waiter_num++;
+    return 0;
+}
+
+/**
+ * @brief Turn one MBAP request into a transaction, a read identical to the
+ *        newest pending transaction of the unit joins it.
+ * @param client
+ * @param frame
+ */
+static void _mbrm_gw_request(uint8_t client, const uint8_t *frame)
+{
+    uint16_t tid = frame[0] << 8 | frame[1];
+    uint16_t pdu_len = (frame[4] << 8 | frame[5]) - 1;
+    uint8_t unit = frame[6];
+    const uint8_t *pdu = frame + 7;
+    mbrm_gateway_trans_t *t, *slot = NULL;
+    uint16_t addr, qty;
+    uint8_t i;
+
+    mbrm_gw_priv->stat.requests++;
+    if (pdu[0] != 0x03 && pdu[0] != 0x06 && pdu[0] != 0x10)
+    {
+        _mbrm_gw_exception(client, tid, unit, pdu[0], MBRM_GATEWAY_EX_ILLEGAL_FUNCTION);
+        return;
+    }
+    if (pdu_len < 5)
+    {
+        _mbrm_gw_exception(client, tid, unit, pdu[0], MBRM_GATEWAY_EX_ILLEGAL_VALUE);
+        return;
+    }
+    addr = pdu[1] << 8 | pdu[2];
+    qty = pdu[3] << 8 | pdu[4];
+
+    switch (pdu[0])
+    {
+    case 0x03:
+        if (qty < 1 || qty > 125 || pdu_len != 5)
+        {
+            _mbrm_gw_exception(client, tid, unit, pdu[0], MBRM_GATEWAY_EX_ILLEGAL_VALUE);
+            return;
+        }
+        /* Only the newest transaction of the unit may be joined, a read
+         * queued before a write would answer with the old values. */
+        for (i = 0; i < MBRM_GATEWAY_TRANS_MAX; i++)
+        {
+            t = &mbrm_gw_priv->trans[i];
+            /* A transaction without waiters was cancelled when its clients left. */
+            if (t->state != MBRM_GATEWAY_TRANS_FREE && t->waiter_num > 0 && t->unit == unit &&
+                    (slot == NULL || t->seq > slot->seq))
+            {
+                slot = t;
+            }
+        }
+        if (slot != NULL && slot->fc == 0x03 && slot->addr == addr && slot->qty == qty &&
+                _mbrm_gw_add_waiter(client, tid, slot) == 0)
+        {
+            mbrm_gw_priv->stat.coalesced++;
+            return;
+        }
+        slot = NULL;
+        break;
+
+    case 0x06:
+        if (pdu_len != 5)
+        {
+            _mbrm_gw_exception(client, tid, unit, pdu[0], MBRM_GATEWAY_EX_ILLEGAL_VALUE);
+            return;
+        }
+        break;
+
+    case 0x10:
+        if (qty < 1 || qty > 123 || pdu_len != 6 + qty * 2 || pdu[5] != qty * 2)
+        {
+            _mbrm_gw_exception(client, tid, unit, pdu[0], MBRM_GATEWAY_EX_ILLEGAL_VALUE);
+            return;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    for (i = 0; i < MBRM_GATEWAY_TRANS_MAX && slot == NULL; i++)
+    {
+        if (mbrm_gw_priv->trans[i].state == MBRM_GATEWAY_TRANS_FREE)
+        {
+            slot = &mbrm_gw_priv->trans[i];
+        }
+    }
+    if (slot == NULL)
+    {
+        _mbrm_gw_exception(client, tid, unit, pdu[0], MBRM_GATEWAY_EX_BUSY);
+        return;
+    }
+
+    memset(slot, 0, sizeof(mbrm_gateway_trans_t));
+    slot->seq = mbrm_gw_priv->seq++;
+    slot->owner = client;
+    slot->unit = unit;
+    slot->fc = pdu[0];
+    slot->addr = addr;
+    slot->qty = (pdu[0] == 0x06) ? 1 : qty;
+    if (pdu[0] == 0x06)
+    {
+        memcpy(slot->data, pdu + 3, 2);
+    }
+    else if (pdu[0] == 0x10)
+    {
+        memcpy(slot->data, pdu + 6, qty * 2);
+    }
+    _mbrm_gw_add_waiter(client, tid, slot);
+    slot->state = MBRM_GATEWAY_TRANS_WAIT;
+    mbrm_gw_priv->clients[client].waiting++;
+}
+
+/**
+ * @brief Forget a client, bus work nobody waits for any more is dropped.
+ * @param client
+ */
+static void _mbrm_gw_close_client(uint8_t client)
+{
+    mbrm_gateway_trans_t *t;
+    uint8_t i, j;
+
+    epoll_ctl(mbrm_gw_priv->epfd, EPOLL_CTL_DEL, mbrm_gw_priv->clients[client].fd, NULL);
+    close(mbrm_gw_priv->clients[client].fd);
+    mbrm_gw_priv->clients[client].fd = -1;
+    mbrm_gw_priv->clients[client].rx_len = 0;
+    mbrm_gw_priv->clients[client].tx_len = 0;
+    mbrm_gw_priv->clients[client].closing = 0;
+
+    for (i = 0; i < MBRM_GATEWAY_TRANS_MAX; i++)
+    {
+        t = &mbrm_gw_priv->trans[i];
+        if (t->state == MBRM_GATEWAY_TRANS_FREE)
+        {
+            continue;
+        }
+        for (j = 0; j < t->waiter_num;)
+        {
+            if (t->waiters[j].client == client)
+            {
+                t->waiters[j] = t->waiters[--t->waiter_num];
+                continue;
+            }
+            j++;
+        }
+        if (t->waiter_num > 0)
+        {
+            /* Another client joined, it inherits the transaction. */
+            if (t->state == MBRM_GATEWAY_TRANS_WAIT && t->owner == client)
+            {
+                t->owner = t->waiters[0].client;
+                mbrm_gw_priv->clients[t->owner].waiting++;
+            }
+            continue;
+        }
+        if (t->state == MBRM_GATEWAY_TRANS_WAIT)
+        {
+            t->state = MBRM_GATEWAY_TRANS_FREE;
+        }
+        else
+        {
+            /* Pops as cancelled with no one to answer, nothing joins it any more. */
+            mbrm_gw_priv->protocol->cancel(t->id);
+        }
+    }
+    mbrm_gw_priv->clients[client].waiting = 0;
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_gw_accept(void)
+{
+    struct epoll_event ev;
+    uint8_t i;
+    int fd;
+
+    while ((fd = accept(mbrm_gw_priv->listen_fd, NULL, NULL)) >= 0)
+    {
+        for (i = 0; i < MBRM_GATEWAY_CLIENT_MAX; i++)
+        {
+            if (mbrm_gw_priv->clients[i].fd < 0)
+            {
+                break;
+            }
+        }
+        if (i >= MBRM_GATEWAY_CLIENT_MAX || _mbrm_gw_nonblock(fd) != 0)
+        {
+            mbrm_log_w("gateway: Client list is full.\r\n");
+            close(fd);
+            continue;
+        }
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        if (epoll_ctl(mbrm_gw_priv->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        mbrm_gw_priv->clients[i].fd = fd;
+        mbrm_gw_priv->clients[i].rx_len = 0;
+        mbrm_gw_priv->clients[i].tx_len = 0;
+        mbrm_gw_priv->clients[i].closing = 0;
+        mbrm_gw_priv->clients[i].waiting = 0;
+    }
+}
+
+/**
+ * @brief
+ * @param client
+ */
+static void _mbrm_gw_read(uint8_t client)
+{
+    mbrm_gateway_client_t *c = &mbrm_gw_priv->clients[client];
+    uint16_t frame_len;
+    ssize_t n;
+
+    for (;;)
+    {
+        n = recv(c->fd, c->rx_buf + c->rx_len, sizeof(c->rx_buf) - c->rx_len, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            _mbrm_gw_close_client(client);
+            return;
+        }
+        if (n < 0)
+        {
+            return;
+        }
+        c->rx_len += n;
+
+        /* Several requests may arrive in one read. */
+        while (c->rx_len >= 7)
+        {
+            frame_len = 6 + (c->rx_buf[4] << 8 | c->rx_buf[5]);
+            if (c->rx_buf[2] != 0 || c->rx_buf[3] != 0 || frame_len < 8 || frame_len > sizeof(c->rx_buf))
+            {
+                mbrm_log_w("gateway: Bad MBAP header.\r\n");
+                _mbrm_gw_close_client(client);
+                return;
+            }
+            if (c->rx_len < frame_len)
+            {
+                break;
+            }
+            _mbrm_gw_request(client, c->rx_buf);
+            c->rx_len -= frame_len;
+            memmove(c->rx_buf, c->rx_buf + frame_len, c->rx_len);
+        }
+    }
+}
+
+/**
+ * @brief Wait for socket activity once and forward new requests.
+ * @param timeout_ms
+ * @return Number of events handled; -1: Not started.
+ */
+static int _mbrm_gw_poll(int timeout_ms)
+{
+    struct epoll_event evs[MBRM_GATEWAY_CLIENT_MAX + 2];
+    uint8_t c;
+    int n, i;
+
+    if (mbrm_gw_priv == NULL || mbrm_gw_priv->epfd < 0)
+    {
+        return -1;
+    }
+    n = epoll_wait(mbrm_gw_priv->epfd, evs, MBRM_GATEWAY_CLIENT_MAX + 2, timeout_ms);
+    for (i = 0; i < n; i++)
+    {
+        if (evs[i].data.u64 == MBRM_GATEWAY_EV_LISTEN)
+        {
+            _mbrm_gw_accept();
+        }
+        else if (evs[i].data.u64 == MBRM_GATEWAY_EV_SERIAL)
+        {
+            RUN_CB(mbrm_gw_priv->cfg.on_serial);
+        }
+        else
+        {
+            c = evs[i].data.u64;
+            if (mbrm_gw_priv->clients[c].fd >= 0 && (evs[i].events & EPOLLOUT))
+            {
+                _mbrm_gw_flush(c);
+            }
+            if (mbrm_gw_priv->clients[c].fd >= 0 && !mbrm_gw_priv->clients[c].closing &&
+                    (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                _mbrm_gw_read(c);
+            }
+        }
+    }
+    _mbrm_gw_dispatch();
+    for (c = 0; c < MBRM_GATEWAY_CLIENT_MAX; c++)
+    {
+        if (mbrm_gw_priv->clients[c].fd >= 0 && mbrm_gw_priv->clients[c].closing)
+        {
+            _mbrm_gw_close_client(c);
+        }
+    }
+    return (n < 0) ? 0 : n;
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_gw_stop(void)
+{
+    uint8_t i;
+
+    if (mbrm_gw_priv == NULL || mbrm_gw_priv->epfd < 0)
+    {
+        return;
+    }
+    for (i = 0; i < MBRM_GATEWAY_CLIENT_MAX; i++)
+    {
+        if (mbrm_gw_priv->clients[i].fd >= 0)
+        {
+            _mbrm_gw_close_client(i);
+        }
+    }
+    close(mbrm_gw_priv->listen_fd);
+    close(mbrm_gw_priv->epfd);
+    mbrm_gw_priv->listen_fd = -1;
+    mbrm_gw_priv->epfd = -1;
+}
+
+/**
+ * @brief Listen for Modbus TCP clients. Protocol receive and timer_over must
+ *        run on the thread calling poll, e.g. through serial_fd/on_serial.
+ *        Waiting transactions are sent from the pop signal so the mutex
+ *        given to init must be recursive.
+ * @param cfg
+ * @return 0 Succeed; -1: Parameter err; 2: Socket fail.
+ */
+static int _mbrm_gw_start(const mbrm_gateway_cfg_t *cfg)
+{
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int one = 1;
+    uint8_t i;
+
+    if (cfg == NULL)
+    {
+        mbrm_log_e("gateway_start: Parameter err.\r\n");
+        return -1;
+    }
+    mbrm_gw_priv = (mbrm_gateway_private_t *)mbrm_gateway.priv;
+    memset(mbrm_gw_priv, 0, sizeof(mbrm_gateway_private_t));
+    mbrm_gw_priv->cfg = *cfg;
+    mbrm_gw_priv->protocol = mbrm_get_protocol();
+    mbrm_gw_priv->epfd = -1;
+    for (i = 0; i < MBRM_GATEWAY_CLIENT_MAX; i++)
+    {
+        mbrm_gw_priv->clients[i].fd = -1;
+    }
+
+    mbrm_gw_priv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (mbrm_gw_priv->listen_fd < 0)
+    {
+        return 2;
+    }
+    setsockopt(mbrm_gw_priv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(cfg->port);
+    if (bind(mbrm_gw_priv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(mbrm_gw_priv->listen_fd, MBRM_GATEWAY_CLIENT_MAX) != 0 ||
+            _mbrm_gw_nonblock(mbrm_gw_priv->listen_fd) != 0)
+    {
+        mbrm_log_e("gateway_start: Socket fail.\r\n");
+        close(mbrm_gw_priv->listen_fd);
+        return 2;
+    }
+
+    mbrm_gw_priv->epfd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.u64 = MBRM_GATEWAY_EV_LISTEN;
+    if (mbrm_gw_priv->epfd < 0 || epoll_ctl(mbrm_gw_priv->epfd, EPOLL_CTL_ADD, mbrm_gw_priv->listen_fd, &ev) != 0)
+    {
+        mbrm_log_e("gateway_start: Socket fail.\r\n");
+        close(mbrm_gw_priv->listen_fd);
+        if (mbrm_gw_priv->epfd >= 0)
+        {
+            close(mbrm_gw_priv->epfd);
+            mbrm_gw_priv->epfd = -1;
+        }
+        return 2;
+    }
+    if (cfg->on_serial != NULL)
+    {
+        ev.events = EPOLLIN;
+        ev.data.u64 = MBRM_GATEWAY_EV_SERIAL;
+        epoll_ctl(mbrm_gw_priv->epfd, EPOLL_CTL_ADD, cfg->serial_fd, &ev);
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ * @param stat
+ */
+static void _mbrm_gw_get_stat(mbrm_gateway_stat_t *stat)
+{
+    if (stat != NULL && mbrm_gw_priv != NULL)
+    {
+        *stat = mbrm_gw_priv->stat;
+    }
+}
+
+static mbrm_gateway_t mbrm_gateway =
+{
+    .start = _mbrm_gw_start,
+    .poll = _mbrm_gw_poll,
+    .stop = _mbrm_gw_stop,
+    .get_stat = _mbrm_gw_get_stat,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_gateway_t *mbrm_get_gateway(void)
+{
+    return &mbrm_gateway;
+}
+
+#endif /* MBRM_GATEWAY_SWITCH */
@@ -0,0 +1,122 @@
+/*
+ * mbrm_gateway.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_GATEWAY_H_
+#define _MODBUS_RTU_MASTER_MBRM_GATEWAY_H_
+
+#include <stdint.h>
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+
+typedef struct
+{
+    int fd;
+    uint16_t rx_len;
+    uint8_t rx_buf[260];
+    /* Transactions waiting for the bus owned by this client. */
+    uint8_t waiting;
+    /* Reply bytes the socket did not take yet, flushed on EPOLLOUT. */
+    uint16_t tx_len;
+    uint8_t tx_buf[MBRM_GATEWAY_TX_MAX];
+    /* Closed at the end of the current poll. */
+    uint8_t closing;
+} mbrm_gateway_client_t;
+
+typedef struct
+{
+    uint8_t client;
+    uint16_t tid;
+} mbrm_gateway_waiter_t;
+
+typedef enum
+{
+    MBRM_GATEWAY_TRANS_FREE = 0,
+    MBRM_GATEWAY_TRANS_WAIT,
+    MBRM_GATEWAY_TRANS_BUS,
+} mbrm_gateway_trans_state_t;
+
+typedef struct
+{
+    mbrm_gateway_trans_state_t state;
+    uint32_t seq;
+    uint32_t id;
+    uint8_t owner;
+    uint8_t unit;
+    uint8_t fc;
+    uint16_t addr;
+    uint16_t qty;
+    uint8_t waiter_num;
+    mbrm_gateway_waiter_t waiters[MBRM_GATEWAY_WAITER_MAX];
+    uint8_t data[250];
+} mbrm_gateway_trans_t;
+
+typedef struct
+{
+    uint16_t port;
+    /* RTU timing of forwarded requests, 0: Library defaults. */
+    uint8_t repeat_max;
+    uint16_t over_time;
+    /* Optional serial fd watched by poll, on_serial is called when readable. */
+    int serial_fd;
+    void (*on_serial)(void);
+} mbrm_gateway_cfg_t;
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t coalesced;
+    uint32_t bus_transactions;
+    uint32_t exceptions;
+} mbrm_gateway_stat_t;
+
+typedef struct
+{
+    int epfd;
+    int listen_fd;
+    uint32_t seq;
+    uint8_t rr;
+    uint8_t on_bus;
+    mbrm_gateway_cfg_t cfg;
+    mbrm_gateway_stat_t stat;
+    mbrm_gateway_client_t clients[MBRM_GATEWAY_CLIENT_MAX];
+    mbrm_gateway_trans_t trans[MBRM_GATEWAY_TRANS_MAX];
+    const mbrm_protocol_t *protocol;
+} mbrm_gateway_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_gateway_private_t)];
+
+    /* PUBLIC */
+    int (*start)(const mbrm_gateway_cfg_t *cfg);
+    int (*poll)(int timeout_ms);
+    void (*stop)(void);
+    void (*get_stat)(mbrm_gateway_stat_t *stat);
+} mbrm_gateway_t;
+
+const mbrm_gateway_t *mbrm_get_gateway(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_GATEWAY_H_ */
@@ -0,0 +1,287 @@
+/*
+ * mbrm_image.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_image.h"
+
+static mbrm_image_class_t mbrm_image;
+static mbrm_image_private_t *mbrm_image_priv;
+
+/**
+ * @brief
+ * @param img
+ * @param from
+ * @return Index of the first dirty register at or after from; num: None.
+ */
+static uint16_t _mbrm_image_next_dirty(const mbrm_image_t *img, uint16_t from)
+{
+    uint16_t w = from / 32;
+    uint32_t bits;
+
+    if (from >= img->num)
+    {
+        return img->num;
+    }
+    bits = img->dirty[w] & (0xFFFFFFFFUL << (from % 32));
+    while (bits == 0)
+    {
+        if (++w >= (img->num + 31) / 32)
+        {
+            return img->num;
+        }
+        bits = img->dirty[w];
+    }
+    from = w * 32 + __builtin_ctz(bits);
+    return (from < img->num) ? from : img->num;
+}
+
+/**
+ * @brief
+ * @param img
+ * @param pos
+ * @param num
+ */
+static void _mbrm_image_mark(mbrm_image_t *img, uint16_t pos, uint16_t num)
+{
+    for (; num > 0; pos++, num--)
+    {
+        img->dirty[pos / 32] |= 1UL << (pos % 32);
+    }
+}
+
+/**
+ * @brief
+ * @param poped
+ */
+static void _mbrm_image_pop_sigingal(uint8_t poped)
+{
+    const mbrm_communication_unit_t *unit = mbrm_image_priv->protocol->get_unit_in_queue(poped);
+    mbrm_image_t *img = (mbrm_image_t *)unit->cfg.user_param;
+
+    if (unit->status != MBRM_QUEUE_STATUS_FINISH)
+    {
+        /* Written again by the next sync. */
+        _mbrm_image_mark(img, unit->cfg.register_addr - img->base, (unit->cfg.cmd == 0x06) ? 1 : unit->cfg.len);
+        if (img->status == MBRM_QUEUE_STATUS_FINISH)
+        {
+            img->status = unit->status;
+        }
+    }
+    if (__atomic_sub_fetch(&img->pending, 1, __ATOMIC_ACQ_REL) == 0 && img->complete_cb != NULL)
+    {
+        img->complete_cb(img->status, img->regs);
+    }
+}
+
+/**
+ * @brief Update the image, repeated writes before a sync cost one frame.
+ * @param img
+ * @param register_addr
+ * @param data
+ * @param num
+ * @return 0 Succeed; -1: Parameter err.
+ */
+static int _mbrm_image_write(mbrm_image_t *img, uint16_t register_addr, const uint16_t *data, uint16_t num)
+{
+    if (img == NULL || data == NULL || register_addr < img->base || register_addr + num > img->base + img->num)
+    {
+        mbrm_log_e("image_write: Parameter err.\r\n");
+        return -1;
+    }
+    memcpy(&img->regs[register_addr - img->base], data, num * 2);
+    _mbrm_image_mark(img, register_addr - img->base, num);
+    return 0;
+}
+
+/**
+ * @brief Grow a range from dirty register s while the next dirty register
+ *        is close enough.
+ * @param img
+ * @param s
+ * @param max_write
+ * @param e Last register of the range.
+ * @return First dirty register after the range; num: None.
+ */
+static uint16_t _mbrm_image_range(const mbrm_image_t *img, uint16_t s, uint16_t max_write, uint16_t *e)
+{
+    uint16_t k = _mbrm_image_next_dirty(img, s + 1);
+
+    *e = s;
+    while (k < img->num && k - *e - 1 <= img->gap && k - s < max_write)
+    {
+        *e = k;
+        k = _mbrm_image_next_dirty(img, k + 1);
+    }
+    return k;
+}
+
+/**
+ * @brief Write the dirty ranges with the fewest 0x06/0x10 frames. Ranges
+ *        apart by up to gap clean registers are merged, blocks follow
+ *        caps.max_write. Ranges that do not fit in the queue stay dirty for
+ *        the next sync, failed frames are marked dirty again.
+ * @param img
+ * @param complete_cb Called once all frames popped, with the first failure.
+ * @return 0 Succeed; -1: Parameter err; 1: Target not found; 2: Sync is running; 3: Queue is full.
+ */
+static int _mbrm_image_sync(mbrm_image_t *img, void (*complete_cb)(mbrm_queue_status_t status, void *data))
+{
+    mbrm_device_info_t *info;
+    uint16_t max_write, s, e, k, i;
+    uint8_t single, frames = 0, sent;
+
+    mbrm_image_priv = (mbrm_image_private_t *)mbrm_image.priv;
+    mbrm_image_priv->protocol = mbrm_get_protocol();
+    if (img == NULL || img->regs == NULL || img->dirty == NULL || img->wire == NULL)
+    {
+        mbrm_log_e("image_sync: Parameter err.\r\n");
+        return -1;
+    }
+    if (__atomic_load_n(&img->pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        mbrm_log_w("image_sync: Sync is running.\r\n");
+        return 2;
+    }
+    info = get_mbrm_devive_obj()->dev_get_info(img->name);
+    if (info == NULL)
+    {
+        mbrm_log_w("image_sync: Target not found.\r\n");
+        return 1;
+    }
+
+    max_write = (info->caps.max_write != 0 && info->caps.max_write < 123) ? info->caps.max_write : 123;
+    if (info->caps.probed && !(info->caps.func & MBRM_FUNC_10))
+    {
+        max_write = 1;
+    }
+    single = !info->caps.probed || (info->caps.func & MBRM_FUNC_06);
+
+    /* Count the frames first, pending must be set before the first can pop. */
+    for (s = _mbrm_image_next_dirty(img, 0); s < img->num && frames < 255; frames++)
+    {
+        s = _mbrm_image_range(img, s, max_write, &e);
+    }
+    if (frames == 0)
+    {
+        if (complete_cb != NULL)
+        {
+            complete_cb(MBRM_QUEUE_STATUS_FINISH, img->regs);
+        }
+        return 0;
+    }
+    if (frames > mbrm_image_priv->protocol->get_free())
+    {
+        frames = mbrm_image_priv->protocol->get_free();
+    }
+    if (frames == 0)
+    {
+        mbrm_log_w("image_sync: Queue is full.\r\n");
+        return 3;
+    }
+
+    img->status = MBRM_QUEUE_STATUS_FINISH;
+    img->complete_cb = complete_cb;
+    __atomic_store_n(&img->pending, frames, __ATOMIC_RELEASE);
+
+    s = _mbrm_image_next_dirty(img, 0);
+    for (sent = 0; sent < frames; sent++)
+    {
+        k = _mbrm_image_range(img, s, max_write, &e);
+        for (i = s; i <= e; i++)
+        {
+            img->wire[i * 2] = img->regs[i] >> 8;
+            img->wire[i * 2 + 1] = img->regs[i] & 0xff;
+            img->dirty[i / 32] &= ~(1UL << (i % 32));
+        }
+
+        mbrm_unit_cfg_t cfg =
+        {
+            .cmd = (s == e && single) ? 0x06 : 0x10,
+            .slave_addr = info->slave_addr,
+            .register_addr = img->base + s,
+            .len = e - s + 1,
+            .repeat_max = info->repeat_max,
+            .over_time = info->over_time,
+            .data = &img->wire[s * 2],
+            .pop_sigingal = _mbrm_image_pop_sigingal,
+            .user_param = img,
+        };
+        if (mbrm_image_priv->protocol->send_cmd(&cfg) != 0)
+        {
+            _mbrm_image_mark(img, s, e - s + 1);
+            mbrm_log_w("image_sync: Queue is full.\r\n");
+            if (sent == 0)
+            {
+                __atomic_store_n(&img->pending, 0, __ATOMIC_RELEASE);
+                return 3;
+            }
+            /* The frames already queued complete the sync, they may all have popped already. */
+            if (__atomic_sub_fetch(&img->pending, frames - sent, __ATOMIC_ACQ_REL) == 0 && complete_cb != NULL)
+            {
+                complete_cb(img->status, img->regs);
+            }
+            break;
+        }
+        s = k;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ * @param img
+ * @return Number of dirty registers.
+ */
+static uint16_t _mbrm_image_get_dirty(const mbrm_image_t *img)
+{
+    uint16_t w, n = 0;
+
+    if (img == NULL || img->dirty == NULL)
+    {
+        return 0;
+    }
+    for (w = 0; w < (img->num + 31) / 32; w++)
+    {
+        n += __builtin_popcount(img->dirty[w]);
+    }
+    return n;
+}
+
+static mbrm_image_class_t mbrm_image =
+{
+    .write = _mbrm_image_write,
+    .sync = _mbrm_image_sync,
+    .get_dirty = _mbrm_image_get_dirty,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_image_class_t *mbrm_get_image(void)
+{
+    return &mbrm_image;
+}
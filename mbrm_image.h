@@ -0,0 +1,76 @@
+/*
+ * mbrm_image.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_IMAGE_H_
+#define _MODBUS_RTU_MASTER_MBRM_IMAGE_H_
+
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+#include "mbrm_device.h"
+
+/**
+ * Mirror of a register range of a registered device. All storage belongs
+ * to the user, regs should start out equal to the slave (e.g. read back)
+ * as registers inside a merged gap are written with their image value.
+ */
+typedef struct
+{
+    char name[MBRM_DEVICE_NAME_LENTH];
+    uint16_t base;
+    uint16_t num;
+    /* num registers, host order. */
+    uint16_t *regs;
+    /* (num + 31) / 32 words, bit set: register changed since the last sync. */
+    uint32_t *dirty;
+    /* 2 * num bytes of frame data, in use while a sync runs. */
+    uint8_t *wire;
+    /* Clean registers between two dirty ranges written to save a frame. */
+    uint8_t gap;
+
+    /* PRIVATE */
+    uint8_t pending;
+    mbrm_queue_status_t status;
+    void (*complete_cb)(mbrm_queue_status_t status, void *data);
+} mbrm_image_t;
+
+typedef struct
+{
+    const mbrm_protocol_t *protocol;
+} mbrm_image_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_image_private_t)];
+
+    /* PUBLIC */
+    int (*write)(mbrm_image_t *img, uint16_t register_addr, const uint16_t *data, uint16_t num);
+    int (*sync)(mbrm_image_t *img, void (*complete_cb)(mbrm_queue_status_t status, void *data));
+    uint16_t (*get_dirty)(const mbrm_image_t *img);
+} mbrm_image_class_t;
+
+const mbrm_image_class_t *mbrm_get_image(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_IMAGE_H_ */
@@ -0,0 +1,378 @@
+/*
+ * mbrm_loop.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+#include "mbrm_loop.h"
+
+#if MBRM_LOOP_SWITCH
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+static mbrm_loop_t mbrm_loop;
+static mbrm_loop_private_t *mbrm_loop_priv;
+
+/**
+ * @brief CLOCK_MONOTONIC in us, the clock of every time given to process.
+ * @param
+ * @return
+ */
+static uint64_t _mbrm_loop_get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+static uint32_t _mbrm_loop_get_time_us(void)
+{
+    return (uint32_t)_mbrm_loop_get_time();
+}
+
+/**
+ * @brief The protocol calls back without a bus, it is the one selected.
+ * @param
+ * @return NULL: The default bus is selected, it is not driven by the loop.
+ */
+static mbrm_loop_bus_t *_mbrm_loop_cur(void)
+{
+    mbrm_bus_t *bus = mbrm_loop_priv->device->bus_selected();
+
+    return (bus == NULL) ? NULL : (mbrm_loop_bus_t *)((char *)bus - offsetof(mbrm_loop_bus_t, bus));
+}
+
+/**
+ * @brief Write as much of the queued request as the port takes.
+ * @param lb
+ */
+static void _mbrm_loop_flush(mbrm_loop_bus_t *lb)
+{
+    ssize_t n;
+
+    while (lb->tx_pos < lb->tx_len)
+    {
+        n = write(lb->cfg.fd, lb->tx_buf + lb->tx_pos, lb->tx_len - lb->tx_pos);
+        if (n > 0)
+        {
+            lb->tx_pos += n;
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            if (n < 0 && errno != EAGAIN)
+            {
+                /* The response timer retries the request. */
+                mbrm_log_e("Loop write fail.\r\n");
+                lb->tx_pos = lb->tx_len;
+            }
+            break;
+        }
+    }
+    if (lb->tx_pos >= lb->tx_len)
+    {
+        lb->tx_pos = 0;
+        lb->tx_len = 0;
+    }
+}
+
+/**
+ * @brief Queue a frame and write what the port takes, the rest goes out
+ *        when process sees the fd writable.
+ * @param data
+ * @param len
+ */
+static void _mbrm_loop_write(const uint8_t *data, uint16_t len)
+{
+    mbrm_loop_bus_t *lb = _mbrm_loop_cur();
+
+    if (lb == NULL || len > sizeof(lb->tx_buf))
+    {
+        mbrm_log_e("Loop write: No bus or frame too long.\r\n");
+        return;
+    }
+    if (lb->tx_len != 0)
+    {
+        /* A retry while the last try is still queued, the slave drops the cut frame. */
+        mbrm_log_w("Loop write: %d bytes dropped.\r\n", lb->tx_len - lb->tx_pos);
+    }
+    /* Whatever is left of an earlier answer would be glued to the next one. */
+    lb->rx_len = 0;
+    lb->frame_end = 0;
+    memcpy(lb->tx_buf, data, len);
+    lb->tx_pos = 0;
+    lb->tx_len = len;
+    _mbrm_loop_flush(lb);
+}
+
+/**
+ * @brief
+ * @param over_time ms
+ */
+static void _mbrm_loop_timer_start(uint16_t over_time)
+{
+    mbrm_loop_bus_t *lb = _mbrm_loop_cur();
+
+    if (lb != NULL)
+    {
+        lb->timer_deadline = _mbrm_loop_get_time() + (uint64_t)over_time * 1000;
+    }
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_loop_timer_stop(void)
+{
+    mbrm_loop_bus_t *lb = _mbrm_loop_cur();
+
+    if (lb != NULL)
+    {
+        lb->timer_deadline = 0;
+    }
+}
+
+/**
+ * @brief Drain the port, a frame ends after gap_us of silence.
+ * @param lb
+ * @param now
+ */
+static void _mbrm_loop_read(mbrm_loop_bus_t *lb, uint64_t now)
+{
+    uint8_t drop[64];
+    ssize_t n;
+
+    for (;;)
+    {
+        if (lb->rx_len < sizeof(lb->rx_buf))
+        {
+            n = read(lb->cfg.fd, lb->rx_buf + lb->rx_len, sizeof(lb->rx_buf) - lb->rx_len);
+        }
+        else
+        {
+            /* Too long for a frame, the CRC check rejects it. */
+            n = read(lb->cfg.fd, drop, sizeof(drop));
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        if (lb->rx_len < sizeof(lb->rx_buf))
+        {
+            lb->rx_len += n;
+        }
+        lb->frame_end = now + lb->gap_us;
+    }
+}
+
+/**
+ * @brief One step of a bus: write the queued request when writable, read
+ *        the port when readable, hand over a frame once the line went
+ *        silent and fire the response timer. A timer due while a frame is
+ *        arriving waits for the frame. The bus is selected meanwhile, the
+ *        selection of the caller is restored.
+ * @param lb
+ * @param now get_time of the event loop iteration.
+ * @param revents POLLIN and POLLOUT bits the fd polled, 0 on a timeout.
+ */
+static void _mbrm_loop_process(mbrm_loop_bus_t *lb, uint64_t now, short revents)
+{
+    mbrm_bus_t *prev;
+    uint16_t len;
+
+    if (lb == NULL || mbrm_loop_priv == NULL)
+    {
+        return;
+    }
+    prev = mbrm_loop_priv->device->bus_select(&lb->bus);
+    if ((revents & POLLOUT) && lb->tx_len != 0)
+    {
+        _mbrm_loop_flush(lb);
+    }
+    if (revents & (POLLIN | POLLERR | POLLHUP))
+    {
+        _mbrm_loop_read(lb, now);
+    }
+    if (lb->frame_end != 0 && now >= lb->frame_end)
+    {
+        len = lb->rx_len;
+        lb->rx_len = 0;
+        lb->frame_end = 0;
+        mbrm_loop_priv->protocol->receive(lb->rx_buf, len);
+    }
+    if (lb->frame_end == 0 && lb->timer_deadline != 0 && now >= lb->timer_deadline)
+    {
+        lb->timer_deadline = 0;
+        mbrm_loop_priv->protocol->timer_over();
+    }
+    mbrm_loop_priv->device->bus_select(prev);
+}
+
+/**
+ * @brief
+ * @param lb
+ * @return
+ */
+static int _mbrm_loop_get_fd(const mbrm_loop_bus_t *lb)
+{
+    return (lb == NULL) ? -1 : lb->cfg.fd;
+}
+
+/**
+ * @brief Events to poll the fd for, POLLOUT only while a request is queued.
+ * @param lb
+ * @return
+ */
+static short _mbrm_loop_get_events(const mbrm_loop_bus_t *lb)
+{
+    if (lb == NULL)
+    {
+        return 0;
+    }
+    return (lb->tx_len != 0) ? (POLLIN | POLLOUT) : POLLIN;
+}
+
+/**
+ * @brief Next time process must run even if the fd stays quiet.
+ * @param lb
+ * @return Absolute get_time; 0: Nothing armed, wait for the fd only.
+ */
+static uint64_t _mbrm_loop_get_deadline(const mbrm_loop_bus_t *lb)
+{
+    if (lb == NULL)
+    {
+        return 0;
+    }
+    if (lb->frame_end != 0)
+    {
+        return lb->frame_end;
+    }
+    return lb->timer_deadline;
+}
+
+/**
+ * @brief get_deadline as a timeout for poll, epoll_wait or uv_timer_start.
+ * @param lb
+ * @param now
+ * @return ms rounded up; -1: Infinite.
+ */
+static int _mbrm_loop_get_timeout(const mbrm_loop_bus_t *lb, uint64_t now)
+{
+    uint64_t deadline = _mbrm_loop_get_deadline(lb);
+
+    if (deadline == 0)
+    {
+        return -1;
+    }
+    if (deadline <= now)
+    {
+        return 0;
+    }
+    return (int)((deadline - now + 999) / 1000);
+}
+
+/**
+ * @brief Set up a bus and select it for the calling thread, then pass
+ *        init_cfg to the device init. Everything runs on the thread of the
+ *        loop, mutex_lock can stay NULL. Requests on the bus are sent with
+ *        it selected, see bus_select.
+ * @param lb
+ * @param cfg
+ * @param init_cfg
+ */
+static void _mbrm_loop_init(mbrm_loop_bus_t *lb, const mbrm_loop_cfg_t *cfg, mbrm_init_cfg *init_cfg)
+{
+    int flags;
+
+    if (lb == NULL || cfg == NULL || init_cfg == NULL || cfg->fd < 0)
+    {
+        mbrm_log_e("loop_init: Parameter err.\r\n");
+        return;
+    }
+    mbrm_loop_priv = (mbrm_loop_private_t *)mbrm_loop.priv;
+    mbrm_loop_priv->protocol = mbrm_get_protocol();
+    mbrm_loop_priv->device = get_mbrm_devive_obj();
+
+    memset(lb, 0, sizeof(mbrm_loop_bus_t));
+    lb->cfg = *cfg;
+    if (lb->cfg.baud == 0)
+    {
+        lb->cfg.baud = 9600;
+    }
+    if (lb->cfg.char_bits == 0)
+    {
+        lb->cfg.char_bits = 11;
+    }
+    lb->gap_us = mbrm_loop_priv->protocol->gap_us(lb->cfg.baud, lb->cfg.char_bits);
+
+    flags = fcntl(cfg->fd, F_GETFL);
+    fcntl(cfg->fd, F_SETFL, flags | O_NONBLOCK);
+
+    init_cfg->write_cb = _mbrm_loop_write;
+    init_cfg->timer_start_cb = _mbrm_loop_timer_start;
+    init_cfg->timer_stop_cb = _mbrm_loop_timer_stop;
+    init_cfg->get_time_us = _mbrm_loop_get_time_us;
+    init_cfg->baud = lb->cfg.baud;
+    init_cfg->char_bits = lb->cfg.char_bits;
+    mbrm_loop_priv->device->bus_select(&lb->bus);
+}
+
+static mbrm_loop_t mbrm_loop =
+{
+    .init = _mbrm_loop_init,
+    .get_time = _mbrm_loop_get_time,
+    .get_fd = _mbrm_loop_get_fd,
+    .get_events = _mbrm_loop_get_events,
+    .get_deadline = _mbrm_loop_get_deadline,
+    .get_timeout = _mbrm_loop_get_timeout,
+    .process = _mbrm_loop_process,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_loop_t *mbrm_get_loop(void)
+{
+    return &mbrm_loop;
+}
+
+#endif /* MBRM_LOOP_SWITCH */
@@ -0,0 +1,88 @@
+/*
+ * mbrm_loop.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_LOOP_H_
+#define _MODBUS_RTU_MASTER_MBRM_LOOP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+#include "mbrm_device.h"
+
+typedef struct
+{
+    /* Serial port opened and configured by the user, set to non-blocking by init. */
+    int fd;
+    uint32_t baud;
+    /* Bits per character including start, parity and stop bits(def: 11). */
+    uint8_t char_bits;
+} mbrm_loop_cfg_t;
+
+/**
+ * One bus driven by the loop, any number of them share the thread of the
+ * event loop. Zeroed by init, kept by the user until the bus is gone.
+ */
+typedef struct
+{
+    mbrm_bus_t bus;
+    mbrm_loop_cfg_t cfg;
+    /* Silence closing a frame, in us. */
+    uint32_t gap_us;
+    /* Absolute times on get_time, 0: Not armed. */
+    uint64_t timer_deadline;
+    uint64_t frame_end;
+    uint16_t rx_len;
+    uint8_t rx_buf[256];
+    /* Request bytes the port did not take yet, written when it polls writable. */
+    uint16_t tx_pos;
+    uint16_t tx_len;
+    uint8_t tx_buf[256];
+} mbrm_loop_bus_t;
+
+typedef struct
+{
+    const mbrm_protocol_t *protocol;
+    const mbrm_device_class_t *device;
+} mbrm_loop_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_loop_private_t)];
+
+    /* PUBLIC */
+    void (*init)(mbrm_loop_bus_t *lb, const mbrm_loop_cfg_t *cfg, mbrm_init_cfg *init_cfg);
+    uint64_t (*get_time)(void);
+    int (*get_fd)(const mbrm_loop_bus_t *lb);
+    short (*get_events)(const mbrm_loop_bus_t *lb);
+    uint64_t (*get_deadline)(const mbrm_loop_bus_t *lb);
+    int (*get_timeout)(const mbrm_loop_bus_t *lb, uint64_t now);
+    void (*process)(mbrm_loop_bus_t *lb, uint64_t now, short revents);
+} mbrm_loop_t;
+
+const mbrm_loop_t *mbrm_get_loop(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_LOOP_H_ */
@@ -0,0 +1,250 @@
+/*
+ * mbrm_mem.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_mem.h"
+
+#if MBRM_MEM_SWITCH
+
+static mbrm_mem_t mbrm_mem;
+static mbrm_mem_private_t *mbrm_mem_priv = (mbrm_mem_private_t *)mbrm_mem.priv;
+
+/**
+ * @brief
+ * @param c
+ * @param size
+ */
+static void _mbrm_mem_charge(mbrm_mem_counter_t *c, uint32_t size)
+{
+    uint32_t live = __atomic_add_fetch(&c->live_bytes, size, __ATOMIC_RELAXED);
+    uint32_t peak = __atomic_load_n(&c->peak_bytes, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&c->live_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+    while (live > peak &&
+            !__atomic_compare_exchange_n(&c->peak_bytes, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/**
+ * @brief
+ * @param c
+ * @param size
+ */
+static void _mbrm_mem_release(mbrm_mem_counter_t *c, uint32_t size)
+{
+    __atomic_sub_fetch(&c->live_bytes, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&c->live_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->frees, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Account one call of malloc_hock, safe to call from any thread.
+ * @param site
+ * @param size
+ * @param ptr Result of malloc_hock.
+ */
+static void _mbrm_mem_on_alloc(mbrm_mem_site_t site, size_t size, const void *ptr)
+{
+    if (site >= MBRM_MEM_SITE_NUM)
+    {
+        return;
+    }
+    if (ptr == NULL)
+    {
+        __atomic_add_fetch(&mbrm_mem_priv->stat.site[site].fails, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&mbrm_mem_priv->stat.total.fails, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    _mbrm_mem_charge(&mbrm_mem_priv->stat.site[site], (uint32_t)size);
+    _mbrm_mem_charge(&mbrm_mem_priv->stat.total, (uint32_t)size);
+}
+
+/**
+ * @brief Account one call of free_hock, size is the one given to malloc_hock.
+ * @param site
+ * @param size
+ */
+static void _mbrm_mem_on_free(mbrm_mem_site_t site, size_t size)
+{
+    if (site >= MBRM_MEM_SITE_NUM)
+    {
+        return;
+    }
+    _mbrm_mem_release(&mbrm_mem_priv->stat.site[site], (uint32_t)size);
+    _mbrm_mem_release(&mbrm_mem_priv->stat.total, (uint32_t)size);
+}
+
+/**
+ * @brief
+ * @param c
+ * @param out
+ */
+static void _mbrm_mem_load(mbrm_mem_counter_t *c, mbrm_mem_counter_t *out)
+{
+    out->live_bytes = __atomic_load_n(&c->live_bytes, __ATOMIC_RELAXED);
+    out->live_blocks = __atomic_load_n(&c->live_blocks, __ATOMIC_RELAXED);
+    out->peak_bytes = __atomic_load_n(&c->peak_bytes, __ATOMIC_RELAXED);
+    out->allocs = __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+    out->frees = __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+    out->fails = __atomic_load_n(&c->fails, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counters since init, each one is exact but they are not read at
+ *        the same instant while requests are in flight.
+ * @param stat
+ */
+static void _mbrm_mem_get_stat(mbrm_mem_stat_t *stat)
+{
+    uint8_t i;
+
+    if (stat == NULL)
+    {
+        return;
+    }
+    _mbrm_mem_load(&mbrm_mem_priv->stat.total, &stat->total);
+    for (i = 0; i < MBRM_MEM_SITE_NUM; i++)
+    {
+        _mbrm_mem_load(&mbrm_mem_priv->stat.site[i], &stat->site[i]);
+    }
+}
+
+/**
+ * @brief
+ * @param now
+ * @param base
+ */
+static void _mbrm_mem_sub(mbrm_mem_counter_t *now, const mbrm_mem_counter_t *base)
+{
+    now->live_bytes -= base->live_bytes;
+    now->live_blocks -= base->live_blocks;
+    now->allocs -= base->allocs;
+    now->frees -= base->frees;
+    now->fails -= base->fails;
+}
+
+/**
+ * @brief Counters since the last mark. live_bytes and live_blocks are the
+ *        growth, negative values wrap; peak_bytes is the high-water mark.
+ *        Divide allocs by the time since the mark for the allocation rate.
+ * @param delta
+ */
+static void _mbrm_mem_get_delta(mbrm_mem_stat_t *delta)
+{
+    uint8_t i;
+
+    if (delta == NULL)
+    {
+        return;
+    }
+    _mbrm_mem_get_stat(delta);
+    _mbrm_mem_sub(&delta->total, &mbrm_mem_priv->base.total);
+    for (i = 0; i < MBRM_MEM_SITE_NUM; i++)
+    {
+        _mbrm_mem_sub(&delta->site[i], &mbrm_mem_priv->base.site[i]);
+    }
+}
+
+/**
+ * @brief Start a measuring window, the high-water marks restart from the
+ *        bytes live now.
+ * @param
+ */
+static void _mbrm_mem_mark(void)
+{
+    uint8_t i;
+
+    _mbrm_mem_get_stat(&mbrm_mem_priv->base);
+    __atomic_store_n(&mbrm_mem_priv->stat.total.peak_bytes, mbrm_mem_priv->base.total.live_bytes, __ATOMIC_RELAXED);
+    for (i = 0; i < MBRM_MEM_SITE_NUM; i++)
+    {
+        __atomic_store_n(&mbrm_mem_priv->stat.site[i].peak_bytes, mbrm_mem_priv->base.site[i].live_bytes,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Check the window since the last mark, call it with the bus idle.
+ *        Every site offending is logged.
+ * @param max_allocs Allocations allowed in the window, 0 for a loop that
+ *        must not touch the heap at all.
+ * @return 0 Steady; 1: Bytes still live that were not at the mark; 2: Too many allocations.
+ */
+static int _mbrm_mem_check_steady(uint32_t max_allocs)
+{
+    static const char *const site_name[MBRM_MEM_SITE_NUM] =
+    {
+        "device",
+        "cmd_info",
+        "payload",
+    };
+    mbrm_mem_stat_t delta;
+    uint8_t i;
+
+    /* Only read by the log, which may be compiled out. */
+    (void)site_name;
+    _mbrm_mem_get_delta(&delta);
+    for (i = 0; i < MBRM_MEM_SITE_NUM; i++)
+    {
+        if (delta.site[i].live_bytes != 0 || delta.site[i].allocs != 0)
+        {
+            mbrm_log_w("Mem %s: %d allocs, %d bytes grown.\r\n", site_name[i],
+                       (int)delta.site[i].allocs, (int)delta.site[i].live_bytes);
+        }
+    }
+    if (delta.total.live_bytes != 0)
+    {
+        return 1;
+    }
+    if (delta.total.allocs > max_allocs)
+    {
+        return 2;
+    }
+    return 0;
+}
+
+static mbrm_mem_t mbrm_mem =
+{
+    .on_alloc = _mbrm_mem_on_alloc,
+    .on_free = _mbrm_mem_on_free,
+    .get_stat = _mbrm_mem_get_stat,
+    .get_delta = _mbrm_mem_get_delta,
+    .mark = _mbrm_mem_mark,
+    .check_steady = _mbrm_mem_check_steady,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_mem_t *mbrm_get_mem(void)
+{
+    return &mbrm_mem;
+}
+
+#endif /* MBRM_MEM_SWITCH */
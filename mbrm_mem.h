@@ -0,0 +1,93 @@
+/*
+ * mbrm_mem.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_MEM_H_
+#define _MODBUS_RTU_MASTER_MBRM_MEM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mbrm_cfg.h"
+
+/**
+ * Call sites of malloc_hock, every allocation is charged to one of them.
+ */
+typedef enum
+{
+    MBRM_MEM_SITE_DEVICE = 0,
+    MBRM_MEM_SITE_CMD_INFO,
+    MBRM_MEM_SITE_PAYLOAD,
+    MBRM_MEM_SITE_NUM,
+} mbrm_mem_site_t;
+
+typedef struct
+{
+    uint32_t live_bytes;
+    uint32_t live_blocks;
+    /* High-water mark of live_bytes since init or the last mark. */
+    uint32_t peak_bytes;
+    uint32_t allocs;
+    uint32_t frees;
+    /* malloc_hock returned NULL. */
+    uint32_t fails;
+} mbrm_mem_counter_t;
+
+typedef struct
+{
+    mbrm_mem_counter_t total;
+    mbrm_mem_counter_t site[MBRM_MEM_SITE_NUM];
+} mbrm_mem_stat_t;
+
+typedef struct
+{
+    mbrm_mem_stat_t stat;
+    /* Counters at the last mark. */
+    mbrm_mem_stat_t base;
+} mbrm_mem_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_mem_private_t)];
+
+    /* PUBLIC */
+    void (*on_alloc)(mbrm_mem_site_t site, size_t size, const void *ptr);
+    void (*on_free)(mbrm_mem_site_t site, size_t size);
+    void (*get_stat)(mbrm_mem_stat_t *stat);
+    void (*get_delta)(mbrm_mem_stat_t *delta);
+    void (*mark)(void);
+    int (*check_steady)(uint32_t max_allocs);
+} mbrm_mem_t;
+
+const mbrm_mem_t *mbrm_get_mem(void);
+
+#if MBRM_MEM_SWITCH
+    #define MBRM_MEM_ALLOC(_site_, _size_, _ptr_) mbrm_get_mem()->on_alloc(_site_, _size_, _ptr_)
+    #define MBRM_MEM_FREE(_site_, _size_) mbrm_get_mem()->on_free(_site_, _size_)
+#else
+    #define MBRM_MEM_ALLOC(_site_, _size_, _ptr_) ((void)(_site_), (void)(_size_), (void)(_ptr_))
+    #define MBRM_MEM_FREE(_site_, _size_) ((void)(_site_), (void)(_size_))
+#endif
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_MEM_H_ */
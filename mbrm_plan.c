@@ -0,0 +1,203 @@
+/*
+ * mbrm_plan.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_plan.h"
+
+static mbrm_plan_t mbrm_plan;
+static mbrm_plan_private_t *mbrm_plan_priv;
+
+/**
+ * @brief
+ * @param cfg
+ * @param chars
+ * @return Time on the wire, in us.
+ */
+static uint32_t _mbrm_plan_chars_us(const mbrm_plan_cfg_t *cfg, uint32_t chars)
+{
+    uint8_t char_bits = (cfg->char_bits != 0) ? cfg->char_bits : 11;
+
+    return (uint32_t)(((uint64_t)chars * char_bits * 1000000 + cfg->baud - 1) / cfg->baud);
+}
+
+/**
+ * @brief Request, 3.5 char gap, turnaround, answer and the gap before the
+ *        next request. Above 19200 baud the gap is fixed to 1750 us.
+ * @param cfg
+ * @param func
+ * @param slave_addr
+ * @param len Registers of the frame.
+ * @return Bus time of one exchange, in us; 0: Parameter err.
+ */
+static uint32_t _mbrm_plan_frame_time_us(const mbrm_plan_cfg_t *cfg, uint8_t func, uint8_t slave_addr, uint16_t len)
+{
+    uint32_t req, rsp, gap, turnaround;
+
+    if (cfg == NULL || cfg->baud == 0)
+    {
+        return 0;
+    }
+
+    switch (func)
+    {
+    case 0x03:
+        req = 8;
+        rsp = 5 + 2 * len;
+        break;
+    case 0x06:
+        req = 8;
+        rsp = 8;
+        break;
+    case 0x10:
+        req = 9 + 2 * len;
+        rsp = 8;
+        break;
+    default:
+        return 0;
+    }
+
+    gap = mbrm_get_protocol()->gap_us(cfg->baud, cfg->char_bits);
+    turnaround = (cfg->turnaround_cb != NULL) ? cfg->turnaround_cb(slave_addr) : 0;
+    if (turnaround == 0)
+    {
+        turnaround = cfg->turnaround_us;
+    }
+    return _mbrm_plan_chars_us(cfg, req + rsp) + 2 * gap + turnaround;
+}
+
+/**
+ * @brief Plan every command of one device, frames are split like the
+ *        device send path does.
+ * @param info
+ * @param arg
+ */
+static void _mbrm_plan_device(mbrm_device_info_t *info, void *arg)
+{
+    mbrm_plan_result_t *result = mbrm_plan_priv->result;
+    mbrm_plan_cmd_t *p;
+    mbrm_device_cmd_t *pcmd;
+    uint16_t total, step, len, k;
+    uint8_t c, elem, limit, repeat_max;
+    uint32_t over_us;
+
+    (void)arg;
+    repeat_max = (info->repeat_max < 1 || info->repeat_max > 3) ? 3 : info->repeat_max;
+    over_us = ((info->over_time < 100 || info->over_time > 1000) ? 2000 : info->over_time) * 1000UL;
+
+    for (c = 0; c < info->cmd_num && result->cmd_num < mbrm_plan_priv->out_max; c++)
+    {
+        pcmd = &info->cmd_list[c];
+        p = &mbrm_plan_priv->out[result->cmd_num++];
+        memset(p, 0, sizeof(mbrm_plan_cmd_t));
+        memcpy(p->name, info->name, MBRM_DEVICE_NAME_LENTH);
+        p->name[MBRM_DEVICE_NAME_LENTH - 1] = 0;
+        p->cmd = c;
+        p->func = pcmd->cmd;
+        p->period_ms = pcmd->period_ms;
+
+        elem = (pcmd->type == MBRM_TYPE_16 || pcmd->type == MBRM_TYPE_INT16 || pcmd->type == MBRM_TYPE_UINT16) ? 1 :
+               (pcmd->type == MBRM_TYPE_FLOAT64 || pcmd->type == MBRM_TYPE_INT64) ? 4 : 2;
+        total = (pcmd->cmd == 0x06) ? 1 : pcmd->num * elem;
+        limit = (pcmd->cmd == 0x03) ? info->caps.max_read : (pcmd->cmd == 0x10) ? info->caps.max_write : 0;
+        step = total;
+        if (limit != 0 && limit < total)
+        {
+            step = (limit < elem) ? elem : limit - limit % elem;
+        }
+
+        for (k = 0; k < total; k += step)
+        {
+            len = (total - k < step) ? total - k : step;
+            p->bus_us += _mbrm_plan_frame_time_us(mbrm_plan_priv->cfg, pcmd->cmd, info->slave_addr, len);
+            p->frames++;
+        }
+        /* Answered at its place in the cycle, after every command ahead used all its tries. */
+        p->latency_us = mbrm_plan_priv->ahead_us + p->bus_us;
+        /* Every own try but the last runs into the timeout too. */
+        p->retry_us = p->latency_us + (repeat_max - 1) * over_us * p->frames;
+        mbrm_plan_priv->ahead_us = p->retry_us;
+        result->cycle_us += p->bus_us;
+        if (p->period_ms != 0)
+        {
+            result->utilization += (p->bus_us + p->period_ms - 1) / p->period_ms;
+        }
+    }
+}
+
+/**
+ * @brief Plan a scan of the registered devices, those with cmd_num set.
+ * @param cfg
+ * @param out One entry per command.
+ * @param out_max
+ * @param result
+ * @return Number of commands that cannot meet their period; -1: Parameter err.
+ */
+static int _mbrm_plan_run(const mbrm_plan_cfg_t *cfg, mbrm_plan_cmd_t *out, uint16_t out_max, mbrm_plan_result_t *result)
+{
+    uint16_t i;
+
+    if (cfg == NULL || cfg->baud == 0 || out == NULL || result == NULL)
+    {
+        mbrm_log_e("plan_run: Parameter err.\r\n");
+        return -1;
+    }
+    mbrm_plan_priv = (mbrm_plan_private_t *)mbrm_plan.priv;
+    mbrm_plan_priv->cfg = cfg;
+    mbrm_plan_priv->out = out;
+    mbrm_plan_priv->out_max = out_max;
+    mbrm_plan_priv->result = result;
+    mbrm_plan_priv->ahead_us = 0;
+    memset(result, 0, sizeof(mbrm_plan_result_t));
+
+    get_mbrm_devive_obj()->dev_foreach(_mbrm_plan_device, NULL);
+
+    for (i = 0; i < result->cmd_num; i++)
+    {
+        /* A command is polled again one cycle later. */
+        out[i].ok = (out[i].period_ms == 0) ||
+                    (result->utilization <= 1000 && result->cycle_us <= out[i].period_ms * 1000UL);
+        if (!out[i].ok)
+        {
+            result->violations++;
+        }
+    }
+    return result->violations;
+}
+
+static mbrm_plan_t mbrm_plan =
+{
+    .frame_time_us = _mbrm_plan_frame_time_us,
+    .run = _mbrm_plan_run,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_plan_t *mbrm_get_plan(void)
+{
+    return &mbrm_plan;
+}
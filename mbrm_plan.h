@@ -0,0 +1,93 @@
+/*
+ * mbrm_plan.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_PLAN_H_
+#define _MODBUS_RTU_MASTER_MBRM_PLAN_H_
+
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+#include "mbrm_device.h"
+
+typedef struct
+{
+    uint32_t baud;
+    /* Bits per character including start, parity and stop bits(def: 11). */
+    uint8_t char_bits;
+    /* Slave turnaround in us, used when turnaround_cb is NULL or returns 0. */
+    uint32_t turnaround_us;
+    uint32_t (*turnaround_cb)(uint8_t slave_addr);
+} mbrm_plan_cfg_t;
+
+typedef struct
+{
+    char name[MBRM_DEVICE_NAME_LENTH];
+    uint8_t cmd;
+    uint8_t func;
+    /* Frames after splitting by caps. */
+    uint8_t frames;
+    /* Bus time of one execution. */
+    uint32_t bus_us;
+    /* Worst case from the start of a cycle, every command ahead using all its tries. */
+    uint32_t latency_us;
+    /* latency_us when every own try times out but the last too. */
+    uint32_t retry_us;
+    uint32_t period_ms;
+    /* The period can be met. */
+    uint8_t ok;
+} mbrm_plan_cmd_t;
+
+typedef struct
+{
+    uint16_t cmd_num;
+    /* One pass over every command. */
+    uint32_t cycle_us;
+    /* Bus time asked for by the poll periods, per mille. */
+    uint32_t utilization;
+    uint16_t violations;
+} mbrm_plan_result_t;
+
+typedef struct
+{
+    const mbrm_plan_cfg_t *cfg;
+    mbrm_plan_cmd_t *out;
+    uint16_t out_max;
+    mbrm_plan_result_t *result;
+    /* Worst case time of the commands planned so far. */
+    uint32_t ahead_us;
+} mbrm_plan_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_plan_private_t)];
+
+    /* PUBLIC */
+    uint32_t (*frame_time_us)(const mbrm_plan_cfg_t *cfg, uint8_t func, uint8_t slave_addr, uint16_t len);
+    int (*run)(const mbrm_plan_cfg_t *cfg, mbrm_plan_cmd_t *out, uint16_t out_max, mbrm_plan_result_t *result);
+} mbrm_plan_t;
+
+const mbrm_plan_t *mbrm_get_plan(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_PLAN_H_ */
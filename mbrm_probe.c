@@ -0,0 +1,293 @@
+/*
+ * mbrm_probe.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_probe.h"
+
+/* Exception code: illegal function. */
+#define MBRM_PROBE_ILLEGAL_FUNCTION 0x01
+
+static mbrm_probe_t mbrm_probe;
+static mbrm_probe_private_t *mbrm_probe_priv;
+
+static void _mbrm_probe_pop_sigingal(uint8_t poped);
+
+/**
+ * @brief
+ * @param cmd
+ * @param register_addr
+ * @param len
+ * @return 0 Succeed; other: Queue is full.
+ */
+static uint8_t _mbrm_probe_send(uint8_t cmd, uint16_t register_addr, uint8_t len)
+{
+    mbrm_unit_cfg_t cfg =
+    {
+        .cmd = cmd,
+        .slave_addr = mbrm_probe_priv->info->slave_addr,
+        .register_addr = register_addr,
+        .len = len,
+        .repeat_max = 1,
+        .over_time = mbrm_probe_priv->over_time,
+        .flags = MBRM_UNIT_FLAG_EXACT_TIME,
+        .data = mbrm_probe_priv->buf,
+        .pop_sigingal = _mbrm_probe_pop_sigingal,
+    };
+    mbrm_probe_priv->len = len;
+    return mbrm_probe_priv->protocol->send_cmd(&cfg);
+}
+
+/**
+ * @brief Report and give back the ref taken by start.
+ * @param result 0 Succeed; 1: Slave does not answer reads; 3: Queue is full.
+ */
+static void _mbrm_probe_finish(int result)
+{
+    mbrm_probe_priv->state = MBRM_PROBE_IDLE;
+    mbrm_probe_priv->info->caps.probed = (result == 0);
+    mbrm_log_i("Probe \"%s\": read %d, write %d, func 0x%02x\r\n", mbrm_probe_priv->info->name,
+               mbrm_probe_priv->info->caps.max_read, mbrm_probe_priv->info->caps.max_write,
+               mbrm_probe_priv->info->caps.func);
+    if (mbrm_probe_priv->done_cb != NULL)
+    {
+        mbrm_probe_priv->done_cb(mbrm_probe_priv->info, result);
+    }
+    get_mbrm_devive_obj()->dev_put(mbrm_probe_priv->info);
+}
+
+/**
+ * @brief One step of the binary search on the block size.
+ * @param ok The last block was accepted.
+ * @return 1: Search finished; 0: Next size is in len.
+ */
+static uint8_t _mbrm_probe_search(uint8_t ok)
+{
+    if (ok)
+    {
+        mbrm_probe_priv->lo = mbrm_probe_priv->len;
+    }
+    else
+    {
+        mbrm_probe_priv->hi = mbrm_probe_priv->len - 1;
+    }
+    if (mbrm_probe_priv->lo >= mbrm_probe_priv->hi)
+    {
+        return 1;
+    }
+    mbrm_probe_priv->len = (mbrm_probe_priv->lo + mbrm_probe_priv->hi + 1) / 2;
+    return 0;
+}
+
+/**
+ * @brief Reads search the largest 0x03 block. With a scratch range the
+ *        range is read, then written back unchanged to test 0x06 and search
+ *        the largest 0x10 block, up to the size of the range.
+ * @param poped
+ */
+static void _mbrm_probe_pop_sigingal(uint8_t poped)
+{
+    const mbrm_communication_unit_t *unit = mbrm_probe_priv->protocol->get_unit_in_queue(poped);
+    mbrm_device_caps_t *caps = &mbrm_probe_priv->info->caps;
+    uint8_t ok = (unit->status == MBRM_QUEUE_STATUS_FINISH);
+    uint8_t ret;
+    uint8_t len;
+
+    switch (mbrm_probe_priv->state)
+    {
+    case MBRM_PROBE_READ:
+        if (mbrm_probe_priv->len == 1 && !ok)
+        {
+            _mbrm_probe_finish((unit->exception == MBRM_PROBE_ILLEGAL_FUNCTION) ? 0 : 1);
+            return;
+        }
+        caps->func |= MBRM_FUNC_03;
+        if (!_mbrm_probe_search(ok))
+        {
+            ret = _mbrm_probe_send(0x03, mbrm_probe_priv->register_addr, mbrm_probe_priv->len);
+            break;
+        }
+        caps->max_read = mbrm_probe_priv->lo;
+        if (mbrm_probe_priv->scratch_num == 0)
+        {
+            /* Other registers may be live, writing them back could undo newer values. */
+            _mbrm_probe_finish(0);
+            return;
+        }
+        mbrm_probe_priv->state = MBRM_PROBE_SCRATCH;
+        len = (mbrm_probe_priv->scratch_num < caps->max_read) ? mbrm_probe_priv->scratch_num : caps->max_read;
+        ret = _mbrm_probe_send(0x03, mbrm_probe_priv->scratch_addr, len);
+        break;
+
+    case MBRM_PROBE_SCRATCH:
+        if (!ok)
+        {
+            _mbrm_probe_finish(0);
+            return;
+        }
+        mbrm_probe_priv->state = MBRM_PROBE_WRITE_SINGLE;
+        mbrm_probe_priv->lo = 0;
+        mbrm_probe_priv->hi = (mbrm_probe_priv->len < 123) ? mbrm_probe_priv->len : 123;
+        ret = _mbrm_probe_send(0x06, mbrm_probe_priv->scratch_addr, 1);
+        break;
+
+    case MBRM_PROBE_WRITE_SINGLE:
+        if (ok)
+        {
+            caps->func |= MBRM_FUNC_06;
+        }
+        mbrm_probe_priv->state = MBRM_PROBE_WRITE_MULTI;
+        ret = _mbrm_probe_send(0x10, mbrm_probe_priv->scratch_addr, 1);
+        break;
+
+    case MBRM_PROBE_WRITE_MULTI:
+        if (mbrm_probe_priv->len == 1 && !ok)
+        {
+            _mbrm_probe_finish(0);
+            return;
+        }
+        caps->func |= MBRM_FUNC_10;
+        if (!_mbrm_probe_search(ok))
+        {
+            ret = _mbrm_probe_send(0x10, mbrm_probe_priv->scratch_addr, mbrm_probe_priv->len);
+            break;
+        }
+        caps->max_write = mbrm_probe_priv->lo;
+        _mbrm_probe_finish(0);
+        return;
+
+    default:
+        return;
+    }
+
+    if (ret != 0)
+    {
+        _mbrm_probe_finish(3);
+    }
+}
+
+/**
+ * @brief Probe the block sizes and function codes of a registered device.
+ *        Probes are chained from the pop signal so the mutex given to init
+ *        must be recursive.
+ * @param name
+ * @param register_addr Start of a readable register range.
+ * @param scratch_addr Start of registers free to overwrite, the write probes
+ *        write back what they read there.
+ * @param scratch_num 0: Writes are not probed, max_write stays unknown.
+ * @param done_cb
+ * @return 0 Succeed; -1: Parameter err; 1: Target not found; 2: Probe is running; 3: Queue is full.
+ */
+static int _mbrm_probe_start(char *name, uint16_t register_addr, uint16_t scratch_addr, uint8_t scratch_num,
+                             void (*done_cb)(mbrm_device_info_t *info, int result))
+{
+    mbrm_device_info_t *info;
+
+    mbrm_probe_priv = (mbrm_probe_private_t *)mbrm_probe.priv;
+    if (name == NULL)
+    {
+        mbrm_log_e("probe_start: Parameter err.\r\n");
+        return -1;
+    }
+    if (mbrm_probe_priv->state != MBRM_PROBE_IDLE)
+    {
+        mbrm_log_w("probe_start: Probe is running.\r\n");
+        return 2;
+    }
+    /* Held until the probe finishes, a detach meanwhile cannot free it. */
+    info = get_mbrm_devive_obj()->dev_get(name);
+    if (info == NULL)
+    {
+        mbrm_log_w("probe_start: Target not found.\r\n");
+        return 1;
+    }
+
+    memset(mbrm_probe_priv, 0, sizeof(mbrm_probe_private_t));
+    mbrm_probe_priv->protocol = mbrm_get_protocol();
+    mbrm_probe_priv->info = info;
+    mbrm_probe_priv->register_addr = register_addr;
+    mbrm_probe_priv->scratch_addr = scratch_addr;
+    mbrm_probe_priv->scratch_num = scratch_num;
+    mbrm_probe_priv->over_time = (info->over_time != 0) ? info->over_time : 1000;
+    mbrm_probe_priv->done_cb = done_cb;
+    mbrm_probe_priv->hi = 125;
+    memset(&info->caps, 0, sizeof(mbrm_device_caps_t));
+
+    mbrm_probe_priv->state = MBRM_PROBE_READ;
+    if (_mbrm_probe_send(0x03, register_addr, 1) != 0)
+    {
+        mbrm_probe_priv->state = MBRM_PROBE_IDLE;
+        get_mbrm_devive_obj()->dev_put(info);
+        return 3;
+    }
+    return 0;
+}
+
+/**
+ * @brief dev_register followed by start.
+ * @param info
+ * @param register_addr
+ * @param scratch_addr
+ * @param scratch_num
+ * @param done_cb
+ * @return Result of dev_register, or of start when the device was registered.
+ */
+static int _mbrm_probe_register_probe(mbrm_device_info_t *info, uint16_t register_addr, uint16_t scratch_addr,
+                                      uint8_t scratch_num, void (*done_cb)(mbrm_device_info_t *info, int result))
+{
+    int ret = get_mbrm_devive_obj()->dev_register(info);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return _mbrm_probe_start(info->name, register_addr, scratch_addr, scratch_num, done_cb);
+}
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+static mbrm_probe_state_t _mbrm_probe_get_state(void)
+{
+    return (mbrm_probe_priv == NULL) ? MBRM_PROBE_IDLE : mbrm_probe_priv->state;
+}
+
+static mbrm_probe_t mbrm_probe =
+{
+    .start = _mbrm_probe_start,
+    .register_probe = _mbrm_probe_register_probe,
+    .get_state = _mbrm_probe_get_state,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_probe_t *mbrm_get_probe(void)
+{
+    return &mbrm_probe;
+}
@@ -0,0 +1,74 @@
+/*
+ * mbrm_probe.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_PROBE_H_
+#define _MODBUS_RTU_MASTER_MBRM_PROBE_H_
+
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+#include "mbrm_device.h"
+
+typedef enum
+{
+    MBRM_PROBE_IDLE = 0,
+    MBRM_PROBE_READ,
+    MBRM_PROBE_SCRATCH,
+    MBRM_PROBE_WRITE_SINGLE,
+    MBRM_PROBE_WRITE_MULTI,
+} mbrm_probe_state_t;
+
+typedef struct
+{
+    mbrm_probe_state_t state;
+    mbrm_device_info_t *info;
+    uint16_t register_addr;
+    /* Registers the write probes may overwrite, 0 num: Writes are not probed. */
+    uint16_t scratch_addr;
+    uint8_t scratch_num;
+    uint16_t over_time;
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t len;
+    uint8_t buf[256];
+    void (*done_cb)(mbrm_device_info_t *info, int result);
+    const mbrm_protocol_t *protocol;
+} mbrm_probe_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_probe_private_t)];
+
+    /* PUBLIC */
+    int (*start)(char *name, uint16_t register_addr, uint16_t scratch_addr, uint8_t scratch_num,
+                 void (*done_cb)(mbrm_device_info_t *info, int result));
+    int (*register_probe)(mbrm_device_info_t *info, uint16_t register_addr, uint16_t scratch_addr,
+                          uint8_t scratch_num, void (*done_cb)(mbrm_device_info_t *info, int result));
+    mbrm_probe_state_t (*get_state)(void);
+} mbrm_probe_t;
+
+const mbrm_probe_t *mbrm_get_probe(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_PROBE_H_ */
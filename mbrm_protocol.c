@@ -25,9 +25,22 @@
 
 #include <string.h>
 #include "mbrm_protocol.h"
+#include "mbrm_trace.h"
+#include "mbrm_rec.h"
 
 static mbrm_protocol_t mbrm_tcb;
-static mbrm_protocol_private_t *mbrm_tcb_priv;
+/* Bus selected by the calling thread, NULL: The one in mbrm_tcb.priv. */
+static MBRM_TLS mbrm_protocol_private_t *mbrm_tcb_sel;
+
+/**
+ * @brief
+ * @param
+ * @return State of the bus selected by the calling thread.
+ */
+static mbrm_protocol_private_t *_mbrm_ctx(void)
+{
+    return (mbrm_tcb_sel != NULL) ? mbrm_tcb_sel : (mbrm_protocol_private_t *)mbrm_tcb.priv;
+}
 
 #if MBRM_CRC_CODE_MODE == 0
 /* CRC High Byte Value Table */
@@ -145,6 +158,7 @@ static uint16_t _mbrm_get_crc_code(const uint8_t *puchMsg, uint16_t usDataLen)
  */
 static void _mbrm_pop_queue(mbrm_queue_status_t status)
 {
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
     uint8_t poped;
     if (mbrm_tcb_priv->queue_tcb.num == 0)
     {
@@ -155,8 +169,12 @@ static void _mbrm_pop_queue(mbrm_queue_status_t status)
 
     RUN_CB(mbrm_tcb_priv->timer_stop_cb);
     mbrm_log_i("POP queue at %d, status = %d\r\n", poped, status);
+    MBRM_TRACE(MBRM_TRACE_POP, status, NULL, 0);
 
     mbrm_tcb_priv->queue_tcb.queue[poped].status = status;
+    MBRM_REC(&mbrm_tcb_priv->queue_tcb.queue[poped],
+             (mbrm_tcb_priv->get_time_us != NULL && mbrm_tcb_priv->queue_tcb.queue[poped].repeat > 0) ?
+             mbrm_tcb_priv->get_time_us() - mbrm_tcb_priv->queue_tcb.queue[poped].start_us : 0);
     mbrm_tcb_priv->queue_tcb.pop_pos++;
     mbrm_tcb_priv->queue_tcb.pop_pos %= MBRM_COMMUNICATION_QUEUE_MAX_LENTH;
     mbrm_tcb_priv->queue_tcb.num--;
@@ -180,6 +198,7 @@ static void _mbrm_pop_queue(mbrm_queue_status_t status)
  */
 static uint8_t _mbrm_push_queue(mbrm_unit_cfg_t *q)
 {
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
     uint8_t pushed;
     uint8_t repeat_max;
     uint16_t overtime;
@@ -193,12 +212,29 @@ static uint8_t _mbrm_push_queue(mbrm_unit_cfg_t *q)
     mbrm_tcb_priv->queue_tcb.queue[pushed].cfg = *q;
     mbrm_tcb_priv->queue_tcb.queue[pushed].status = MBRM_QUEUE_STATUS_WAIT;
     mbrm_tcb_priv->queue_tcb.queue[pushed].repeat = 0;
+    mbrm_tcb_priv->queue_tcb.queue[pushed].cancel = 0;
+    mbrm_tcb_priv->queue_tcb.queue[pushed].exception = 0;
 
-    repeat_max = mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.repeat_max;
-    mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.repeat_max = (repeat_max < 1 || repeat_max > 3) ? 3 : repeat_max;
+    /* 0 is never used as an id. */
+    if (++mbrm_tcb_priv->id_seq == 0)
+    {
+        mbrm_tcb_priv->id_seq = 1;
+    }
+    q->id = mbrm_tcb_priv->id_seq;
+    mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.id = q->id;
 
+    repeat_max = mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.repeat_max;
     overtime = mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.over_time;
-    mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.over_time = (overtime < 100 || overtime > 1000) ? 2000 : overtime;
+    if (q->flags & MBRM_UNIT_FLAG_EXACT_TIME)
+    {
+        mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.repeat_max = (repeat_max < 1) ? 1 : repeat_max;
+        mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.over_time = (overtime < 1) ? 1 : overtime;
+    }
+    else
+    {
+        mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.repeat_max = (repeat_max < 1 || repeat_max > 3) ? 3 : repeat_max;
+        mbrm_tcb_priv->queue_tcb.queue[pushed].cfg.over_time = (overtime < 100 || overtime > 1000) ? 2000 : overtime;
+    }
 
     mbrm_tcb_priv->queue_tcb.push_pos++;
     mbrm_tcb_priv->queue_tcb.push_pos %= MBRM_COMMUNICATION_QUEUE_MAX_LENTH;
@@ -215,81 +251,125 @@ static uint8_t _mbrm_push_queue(mbrm_unit_cfg_t *q)
 
 /**
  * @brief
- * @param queue_pos
+ * @param q
+ * @return Length of the request frame of q.
  */
-void _mbrm_send_data(uint8_t queue_pos)
+static uint16_t _mbrm_frame_len(const mbrm_unit_cfg_t *q)
 {
-    mbrm_communication_unit_t *unit = &mbrm_tcb_priv->queue_tcb.queue[queue_pos];
+    return (q->cmd == 0x10) ? 7 + q->len * 2 + 2 : 8;
+}
+
+/**
+ * @brief Build the request frame of a unit, CRC included.
+ * @param q
+ * @param buf At least 9 + 2 * len bytes.
+ * @return Frame length; 0: Unknown command.
+ */
+static uint16_t _mbrm_encode(const mbrm_unit_cfg_t *q, uint8_t *buf)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
     uint16_t crc_code;
-    uint16_t send_data_lenth = 0;
+    uint16_t send_data_lenth = _mbrm_frame_len(q);
 
-    unit->repeat++;
-    if (unit->repeat > unit->cfg.repeat_max)
-    {
-        mbrm_tcb_priv->pop_queue(MBRM_QUEUE_STATUS_OVER_TIME);
-        return;
-    }
+    buf[0] = q->slave_addr;
+    buf[1] = q->cmd;
+    buf[2] = q->register_addr >> 8;
+    buf[3] = q->register_addr & 0xff;
 
-    switch (unit->cfg.cmd)
+    switch (q->cmd)
     {
     case 0x03:
-        send_data_lenth = 8;
-        mbrm_tcb_priv->send_buf[0] = unit->cfg.slave_addr;
-        mbrm_tcb_priv->send_buf[1] = unit->cfg.cmd;
-        mbrm_tcb_priv->send_buf[2] = unit->cfg.register_addr >> 8;
-        mbrm_tcb_priv->send_buf[3] = unit->cfg.register_addr & 0xff;
-        mbrm_tcb_priv->send_buf[4] = 0;
-        mbrm_tcb_priv->send_buf[5] = unit->cfg.len;
-        crc_code = mbrm_tcb_priv->get_crc(mbrm_tcb_priv->send_buf, 6);
-        mbrm_tcb_priv->send_buf[6] = crc_code;
-        mbrm_tcb_priv->send_buf[7] = crc_code >> 8;
+        buf[4] = 0;
+        buf[5] = q->len;
         break;
 
     case 0x06:
-        send_data_lenth = 8;
-        mbrm_tcb_priv->send_buf[0] = unit->cfg.slave_addr;
-        mbrm_tcb_priv->send_buf[1] = unit->cfg.cmd;
-        mbrm_tcb_priv->send_buf[2] = unit->cfg.register_addr >> 8;
-        mbrm_tcb_priv->send_buf[3] = unit->cfg.register_addr & 0xff;
-        mbrm_tcb_priv->send_buf[4] = unit->cfg.data[0];
-        mbrm_tcb_priv->send_buf[5] = unit->cfg.data[1];
-        crc_code = mbrm_tcb_priv->get_crc(mbrm_tcb_priv->send_buf, 6);
-        mbrm_tcb_priv->send_buf[6] = crc_code;
-        mbrm_tcb_priv->send_buf[7] = crc_code >> 8;
+        buf[4] = q->data[0];
+        buf[5] = q->data[1];
         break;
 
     case 0x10:
-        send_data_lenth = 7 + unit->cfg.len * 2 + 2;
-        mbrm_tcb_priv->send_buf[0] = unit->cfg.slave_addr;
-        mbrm_tcb_priv->send_buf[1] = unit->cfg.cmd;
-        mbrm_tcb_priv->send_buf[2] = unit->cfg.register_addr >> 8;
-        mbrm_tcb_priv->send_buf[3] = unit->cfg.register_addr & 0xff;
-        mbrm_tcb_priv->send_buf[4] = 0;
-        mbrm_tcb_priv->send_buf[5] = unit->cfg.len;
-        mbrm_tcb_priv->send_buf[6] = unit->cfg.len * 2;
-        for (uint8_t i = 0; i < unit->cfg.len * 2; i++)
-        {
-            mbrm_tcb_priv->send_buf[7 + i] = unit->cfg.data[i];
-        }
-        crc_code = mbrm_tcb_priv->get_crc(mbrm_tcb_priv->send_buf, send_data_lenth - 2);
-        mbrm_tcb_priv->send_buf[send_data_lenth - 2] = crc_code & 0xff;
-        mbrm_tcb_priv->send_buf[send_data_lenth - 1] = crc_code >> 8;
+        buf[4] = 0;
+        buf[5] = q->len;
+        buf[6] = q->len * 2;
+        memcpy(&buf[7], q->data, q->len * 2);
         break;
 
     default:
-        mbrm_log_e("Unknown command: 0x%02x\r\n", unit->cfg.cmd);
-        break;
+        mbrm_log_e("Unknown command: 0x%02x\r\n", q->cmd);
+        return 0;
+    }
+
+    crc_code = mbrm_tcb_priv->get_crc(buf, send_data_lenth - 2);
+    buf[send_data_lenth - 2] = crc_code & 0xff;
+    buf[send_data_lenth - 1] = crc_code >> 8;
+    return send_data_lenth;
+}
+
+/**
+ * @brief
+ * @param queue_pos
+ */
+void _mbrm_send_data(uint8_t queue_pos)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+    mbrm_communication_unit_t *unit = &mbrm_tcb_priv->queue_tcb.queue[queue_pos];
+
+    /* Drop stale units before spending bus time on them. */
+    if (unit->cancel)
+    {
+        mbrm_tcb_priv->pop_queue(MBRM_QUEUE_STATUS_CANCEL);
+        return;
+    }
+    if (unit->cfg.deadline != 0 && mbrm_tcb_priv->get_time_us != NULL &&
+            (int32_t)(mbrm_tcb_priv->get_time_us() - unit->cfg.deadline) >= 0)
+    {
+        mbrm_tcb_priv->pop_queue(MBRM_QUEUE_STATUS_EXPIRED);
+        return;
+    }
+
+    unit->repeat++;
+    if (unit->repeat > unit->cfg.repeat_max)
+    {
+        /* Still busy after the last try. */
+        mbrm_tcb_priv->pop_queue((unit->exception != 0) ? MBRM_QUEUE_STATUS_ERROR : MBRM_QUEUE_STATUS_OVER_TIME);
+        return;
+    }
+    if (unit->repeat > 1)
+    {
+        /* Only the answer to the last try decides between ERROR and OVER_TIME. */
+        unit->exception = 0;
+        MBRM_TRACE(MBRM_TRACE_RETRY, unit->repeat, NULL, 0);
+    }
+
+    /* A retry resends the frame already built, other units are encoded once. */
+    if (unit->repeat == 1)
+    {
+        unit->start_us = (mbrm_tcb_priv->get_time_us != NULL) ? mbrm_tcb_priv->get_time_us() : 0;
+        if (unit->cfg.frame != NULL)
+        {
+            mbrm_tcb_priv->tx_buf = unit->cfg.frame;
+            mbrm_tcb_priv->tx_len = _mbrm_frame_len(&unit->cfg);
+        }
+        else
+        {
+            mbrm_tcb_priv->tx_buf = mbrm_tcb_priv->send_buf;
+            mbrm_tcb_priv->tx_len = _mbrm_encode(&unit->cfg, mbrm_tcb_priv->send_buf);
+        }
     }
 
+    mbrm_tcb_priv->tx_us = (mbrm_tcb_priv->get_time_us != NULL) ? mbrm_tcb_priv->get_time_us() : 0;
     if (mbrm_tcb_priv->write_cb != NULL)
     {
-        mbrm_tcb_priv->write_cb(mbrm_tcb_priv->send_buf, send_data_lenth);
+        mbrm_tcb_priv->write_cb(mbrm_tcb_priv->tx_buf, mbrm_tcb_priv->tx_len);
     }
+    MBRM_TRACE(MBRM_TRACE_TX, queue_pos, mbrm_tcb_priv->tx_buf, mbrm_tcb_priv->tx_len);
 
     if (mbrm_tcb_priv->timer_start_cb != NULL)
     {
         mbrm_tcb_priv->timer_start_cb(unit->cfg.over_time);
     }
+    MBRM_TRACE(MBRM_TRACE_TIMER_START, queue_pos, NULL, 0);
 }
 
 /**
@@ -298,10 +378,94 @@ void _mbrm_send_data(uint8_t queue_pos)
  */
 static void _mbrm_timer_over(void)
 {
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
     mbrm_log_i("Timer Over\r\n");
+    MBRM_TRACE(MBRM_TRACE_TIMER_OVER, mbrm_tcb_priv->queue_tcb.pop_pos, NULL, 0);
     mbrm_tcb_priv->send_data(mbrm_tcb_priv->queue_tcb.pop_pos);
 }
 
+/**
+ * @brief
+ * @param data
+ * @param len
+ * @return 0 Succeed; 1: Too short or CRC err.
+ */
+static int _mbrm_check_frame(const uint8_t *data, uint16_t len)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
+    if (data == NULL || len < 4)
+    {
+        return 1;
+    }
+    return (mbrm_tcb_priv->get_crc(data, len - 2) != (data[len - 1] << 8 | data[len - 2])) ? 1 : 0;
+}
+
+/**
+ * @brief Resend the unit on the bus after ms instead of its over_time, the
+ *        retry counts against repeat_max.
+ * @param ms
+ */
+static void _mbrm_retry_after(uint16_t ms)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
+    RUN_CB(mbrm_tcb_priv->timer_stop_cb);
+    if (mbrm_tcb_priv->timer_start_cb != NULL)
+    {
+        mbrm_tcb_priv->timer_start_cb(ms);
+    }
+}
+
+/**
+ * @brief Check a frame with a good CRC against the unit on the bus. A late
+ *        answer to an earlier transmission, of this unit or another one,
+ *        comes from another slave, too early to answer the last
+ *        transmission, or with the length or echo of another request.
+ * @param unit
+ * @param data
+ * @param len
+ * @return 0 Answer of the unit; 1: Other slave; 2: Too early; 3: Function, length or echo does not match.
+ */
+static int _mbrm_match(const mbrm_communication_unit_t *unit, const uint8_t *data, uint16_t len)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+    uint32_t min_us;
+
+    if (data[0] != unit->cfg.slave_addr)
+    {
+        return 1;
+    }
+    /* Both frames on the line, less 1 ms so a ms clock never drops a good answer. */
+    if (mbrm_tcb_priv->char_us != 0 && mbrm_tcb_priv->get_time_us != NULL)
+    {
+        min_us = (uint32_t)(mbrm_tcb_priv->tx_len + len) * mbrm_tcb_priv->char_us;
+        if (min_us > 1000 && mbrm_tcb_priv->get_time_us() - mbrm_tcb_priv->tx_us < min_us - 1000)
+        {
+            return 2;
+        }
+    }
+    if (data[1] == (unit->cfg.cmd | 0x80))
+    {
+        return (len == 5) ? 0 : 3;
+    }
+    if (data[1] != unit->cfg.cmd)
+    {
+        return 3;
+    }
+    switch (unit->cfg.cmd)
+    {
+    case 0x03:
+        return (len == 5 + 2 * unit->cfg.len && data[2] == 2 * unit->cfg.len) ? 0 : 3;
+    case 0x06:
+    case 0x10:
+        return (len == 8 && memcmp(data + 2, mbrm_tcb_priv->tx_buf + 2, 4) == 0) ? 0 : 3;
+    default:
+        return 0;
+    }
+}
+
 /**
  * @brief
  * @param data
@@ -309,25 +473,66 @@ static void _mbrm_timer_over(void)
  */
 static void _mbrm_receive(const uint8_t *data, uint16_t len)
 {
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
     RUN_CB(mbrm_tcb_priv->mutex_lock);
+    MBRM_TRACE(MBRM_TRACE_RX, mbrm_tcb_priv->queue_tcb.pop_pos, data, len);
+
+    /* 1.CRC: a broken answer is retried after the frame gap, a busy slave keeps its back-off. */
+    if (_mbrm_check_frame(data, len) != 0)
+    {
+        mbrm_tcb_priv->stat.corrupt++;
+        if (mbrm_tcb_priv->gap_ms != 0 && mbrm_tcb_priv->queue_tcb.num > 0 &&
+                mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos].exception != MBRM_EXCEPTION_BUSY)
+        {
+            _mbrm_retry_after(mbrm_tcb_priv->gap_ms);
+        }
+        RUN_CB(mbrm_tcb_priv->mutex_unlock);
+        return;
+    }
 
-    /* 1.Slave addr */
-    if (data[0] != mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos].cfg.slave_addr)
+    /* 2.Stale: dropped, the unit keeps waiting for its answer. */
+    switch ((mbrm_tcb_priv->queue_tcb.num == 0) ? 1 :
+            _mbrm_match(&mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos], data, len))
     {
+    case 0:
+        break;
+    case 1:
+        mbrm_tcb_priv->stat.foreign++;
+        RUN_CB(mbrm_tcb_priv->mutex_unlock);
+        return;
+    case 2:
+        mbrm_tcb_priv->stat.early++;
+        RUN_CB(mbrm_tcb_priv->mutex_unlock);
+        return;
+    default:
+        mbrm_tcb_priv->stat.mismatch++;
         RUN_CB(mbrm_tcb_priv->mutex_unlock);
         return;
     }
 
-    /* 2.CRC */
-    if (mbrm_tcb_priv->get_crc(data, len - 2) != (data[len - 1] << 8 | data[len - 2]))
+    /* The answer is of no use any more. */
+    if (mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos].cancel)
     {
+        mbrm_tcb_priv->pop_queue(MBRM_QUEUE_STATUS_CANCEL);
         RUN_CB(mbrm_tcb_priv->mutex_unlock);
         return;
     }
 
-    /* 3.Cmd */
+    /* 3.Exception */
     if (data[1] != mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos].cfg.cmd)
     {
+        if (data[1] == (mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos].cfg.cmd | 0x80))
+        {
+            mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos].exception = data[2];
+            /* Slave device busy, try again later. Other exceptions fail at once. */
+            if (data[2] == MBRM_EXCEPTION_BUSY)
+            {
+                _mbrm_retry_after(mbrm_tcb_priv->busy_delay);
+                RUN_CB(mbrm_tcb_priv->mutex_unlock);
+                return;
+            }
+        }
         mbrm_tcb_priv->pop_queue(MBRM_QUEUE_STATUS_ERROR);
         RUN_CB(mbrm_tcb_priv->mutex_unlock);
         return;
@@ -352,6 +557,8 @@ static void _mbrm_receive(const uint8_t *data, uint16_t len)
         RUN_CB(mbrm_tcb_priv->mutex_unlock);
         return;
     }
+    /* A busy answer before does not matter any more. */
+    mbrm_tcb_priv->queue_tcb.queue[mbrm_tcb_priv->queue_tcb.pop_pos].exception = 0;
     mbrm_tcb_priv->pop_queue(MBRM_QUEUE_STATUS_FINISH);
     RUN_CB(mbrm_tcb_priv->mutex_unlock);
 
@@ -364,6 +571,7 @@ static void _mbrm_receive(const uint8_t *data, uint16_t len)
  */
 static uint8_t _mbrm_send_cmd(mbrm_unit_cfg_t *q)
 {
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
     uint8_t ret;
     if (q == NULL)
     {
@@ -383,8 +591,40 @@ static uint8_t _mbrm_send_cmd(mbrm_unit_cfg_t *q)
     return ret;
 }
 
+/**
+ * @brief Mark a queued unit as cancelled, with every unit of its group.
+ *        Waiting units are dropped without being sent, the unit on the bus
+ *        stops retrying.
+ * @param id
+ * @return 0 Succeed; 1: Not found target.
+ */
+static int _mbrm_cancel(uint32_t id)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+    uint8_t pos;
+    uint16_t i;
+    int ret = 1;
+
+    RUN_CB(mbrm_tcb_priv->mutex_lock);
+    pos = mbrm_tcb_priv->queue_tcb.pop_pos;
+    for (i = 0; i < mbrm_tcb_priv->queue_tcb.num; i++)
+    {
+        if (mbrm_tcb_priv->queue_tcb.queue[pos].cfg.id == id || mbrm_tcb_priv->queue_tcb.queue[pos].cfg.group == id)
+        {
+            mbrm_tcb_priv->queue_tcb.queue[pos].cancel = 1;
+            ret = 0;
+        }
+        pos = (pos + 1) % MBRM_COMMUNICATION_QUEUE_MAX_LENTH;
+    }
+    RUN_CB(mbrm_tcb_priv->mutex_unlock);
+
+    return ret;
+}
+
 const mbrm_communication_unit_t *_mbrm_get_unit_in_queue(uint8_t pos)
 {
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
     return &mbrm_tcb_priv->queue_tcb.queue[pos];
 }
 
@@ -395,16 +635,83 @@ const mbrm_communication_unit_t *_mbrm_get_unit_in_queue(uint8_t pos)
  */
 static mbrm_protocol_status_t _mbrm_get_status(void)
 {
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
     return mbrm_tcb_priv->status;
 }
 
+/**
+ * @brief
+ * @param
+ * @return uint32_t us, 0 if no clock is configured.
+ */
+static uint32_t _mbrm_get_time_us(void)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
+    if (mbrm_tcb_priv->get_time_us == NULL)
+    {
+        return 0;
+    }
+    return mbrm_tcb_priv->get_time_us();
+}
+
+/**
+ * @brief Silent interval that ends an RTU frame, 3.5 characters and fixed to
+ *        1750 us above 19200 baud.
+ * @param baud
+ * @param char_bits 0: 11 bits.
+ * @return us, rounded up; 0: Unknown baud.
+ */
+static uint32_t _mbrm_gap_us(uint32_t baud, uint8_t char_bits)
+{
+    if (baud == 0)
+    {
+        return 0;
+    }
+    if (baud > 19200)
+    {
+        return 1750;
+    }
+    char_bits = (char_bits != 0) ? char_bits : 11;
+    return (uint32_t)((35ULL * char_bits * 100000 + baud - 1) / baud);
+}
+
+/**
+ * @brief Counters of answers dropped since init.
+ * @param stat
+ */
+static void _mbrm_get_stat(mbrm_protocol_stat_t *stat)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
+    if (stat != NULL)
+    {
+        RUN_CB(mbrm_tcb_priv->mutex_lock);
+        *stat = mbrm_tcb_priv->stat;
+        RUN_CB(mbrm_tcb_priv->mutex_unlock);
+    }
+}
+
+/**
+ * @brief
+ * @param
+ * @return Number of free places in the queue.
+ */
+static uint8_t _mbrm_get_free(void)
+{
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
+
+    return MBRM_COMMUNICATION_QUEUE_MAX_LENTH - mbrm_tcb_priv->queue_tcb.num;
+}
+
 /**
  * @brief
  * @param cfg
  */
 static void _mbrm_init(const mbrm_init_cfg *cfg)
 {
-    mbrm_tcb_priv = (mbrm_protocol_private_t *)mbrm_tcb.priv;
+    mbrm_protocol_private_t *mbrm_tcb_priv = _mbrm_ctx();
 
     mbrm_tcb_priv->get_crc = _mbrm_get_crc_code;
     mbrm_tcb_priv->pop_queue = _mbrm_pop_queue;
@@ -420,6 +727,33 @@ static void _mbrm_init(const mbrm_init_cfg *cfg)
     mbrm_tcb_priv->mutex_unlock = cfg->mutex_unlock;
     mbrm_tcb_priv->timer_start_cb = cfg->timer_start_cb;
     mbrm_tcb_priv->timer_stop_cb = cfg->timer_stop_cb;
+    mbrm_tcb_priv->get_time_us = cfg->get_time_us;
+    mbrm_tcb_priv->busy_delay = (cfg->busy_delay != 0) ? cfg->busy_delay : 100;
+    /* Rounded up to the timer's ms. */
+    mbrm_tcb_priv->gap_ms = (uint16_t)((_mbrm_gap_us(cfg->baud, cfg->char_bits) + 999) / 1000);
+    mbrm_tcb_priv->char_us = 0;
+    if (cfg->baud != 0)
+    {
+        mbrm_tcb_priv->char_us = (((cfg->char_bits != 0) ? cfg->char_bits : 11) * 1000000UL + cfg->baud - 1) / cfg->baud;
+    }
+    memset(&mbrm_tcb_priv->stat, 0, sizeof(mbrm_protocol_stat_t));
+#if MBRM_TRACE_SWITCH
+    mbrm_get_trace()->init(cfg->get_time_us);
+#endif
+}
+
+/**
+ * @brief Select the bus the calling thread works on, later calls of the
+ *        thread act on it and its callbacks run with it selected.
+ * @param ctx Zeroed state of the bus until its init; NULL: The default bus.
+ * @return Bus selected before, NULL: The default bus.
+ */
+static mbrm_protocol_private_t *_mbrm_select(mbrm_protocol_private_t *ctx)
+{
+    mbrm_protocol_private_t *prev = mbrm_tcb_sel;
+
+    mbrm_tcb_sel = ctx;
+    return prev;
 }
 
 static mbrm_protocol_t mbrm_tcb =
@@ -427,9 +761,18 @@ static mbrm_protocol_t mbrm_tcb =
     .init = _mbrm_init,
     .receive = _mbrm_receive,
     .send_cmd = _mbrm_send_cmd,
+    .cancel = _mbrm_cancel,
     .get_status = _mbrm_get_status,
+    .get_free = _mbrm_get_free,
     .get_unit_in_queue = _mbrm_get_unit_in_queue,
     .timer_over = _mbrm_timer_over,
+    .get_crc = _mbrm_get_crc_code,
+    .check_frame = _mbrm_check_frame,
+    .encode = _mbrm_encode,
+    .get_time_us = _mbrm_get_time_us,
+    .get_stat = _mbrm_get_stat,
+    .gap_us = _mbrm_gap_us,
+    .select = _mbrm_select,
 };
 
 /**
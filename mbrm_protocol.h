@@ -32,6 +32,12 @@
 
 #define RUN_CB(_cb_)  do{if(_cb_ != NULL) {_cb_();}}while (0)
 
+/* over_time and repeat_max are used as given instead of being clamped. */
+#define MBRM_UNIT_FLAG_EXACT_TIME 0x01
+
+/* Exception code: slave device busy. */
+#define MBRM_EXCEPTION_BUSY 0x06
+
 typedef enum
 {
     MBRM_PROTOCOL_STATUS_FREE = 0,
@@ -44,6 +50,8 @@ typedef enum
     MBRM_QUEUE_STATUS_WAIT,
     MBRM_QUEUE_STATUS_OVER_TIME,
     MBRM_QUEUE_STATUS_ERROR,
+    MBRM_QUEUE_STATUS_CANCEL,
+    MBRM_QUEUE_STATUS_EXPIRED,
 } mbrm_queue_status_t;
 
 typedef struct
@@ -54,7 +62,16 @@ typedef struct
     uint8_t len;
     uint8_t repeat_max;
     uint16_t over_time;
+    uint8_t flags;
+    /* Absolute time on get_time_us after which the unit is dropped, 0: none. */
+    uint32_t deadline;
+    /* Filled by send_cmd, used to cancel the unit. */
+    uint32_t id;
+    /* Cancelling this id cancels the unit too, the parts of a split command share the first id(0: None). */
+    uint32_t group;
     uint8_t *data;
+    /* Request frame built by encode and kept by the caller until the unit pops, NULL: Encoded on send. */
+    const uint8_t *frame;
     void (*pop_sigingal)(uint8_t poped);
     void *user_param;
 } mbrm_unit_cfg_t;
@@ -62,6 +79,11 @@ typedef struct
 typedef struct
 {
     uint8_t repeat;
+    uint8_t cancel;
+    /* Exception code of the answer, 0: None. */
+    uint8_t exception;
+    /* get_time_us at the first transmission. */
+    uint32_t start_us;
     mbrm_queue_status_t status;
     mbrm_unit_cfg_t cfg;
 } mbrm_communication_unit_t;
@@ -83,14 +105,37 @@ typedef struct
     void (*timer_stop_cb)(void);
     void *(*malloc_hock)(size_t size);
     void (*free_hock)(void *ptr);
+    uint32_t (*get_time_us)(void);
+    /* Line speed, enables the fast retry after a corrupt answer and drops answers too early for the last request(0: Off). */
+    uint32_t baud;
+    /* Bits per character, start, data, parity and stop bits(def: 11). */
+    uint8_t char_bits;
+    /* Delay before retrying a slave that answered busy, in ms(def: 100). */
+    uint16_t busy_delay;
+    /* Number of the bus, keys the values it publishes to shared memory(def: 0). */
+    uint16_t bus_id;
 } mbrm_init_cfg;
 
+typedef struct
+{
+    /* Answers with a bad CRC, retried after the frame gap. */
+    uint32_t corrupt;
+    /* Good frames dropped as not answering the unit on the bus. */
+    uint32_t foreign;
+    uint32_t early;
+    uint32_t mismatch;
+} mbrm_protocol_stat_t;
+
+/* State of one bus, the default one is kept in priv, others are passed to select. */
 typedef struct
 {
     uint8_t send_buf[256];
+    const uint8_t *tx_buf;
+    uint16_t tx_len;
     mbrm_protocol_status_t status;
     mbrm_queue_t queue_tcb;
     uint16_t (*get_crc)(const uint8_t *, uint16_t);
+    uint32_t id_seq;
     void (*pop_queue)(mbrm_queue_status_t);
     uint8_t (*push_queue)(mbrm_unit_cfg_t *q);
     void (*write_cb)(const uint8_t *, uint16_t);
@@ -98,6 +143,14 @@ typedef struct
     void (*mutex_unlock)(void);
     void (*timer_start_cb)(uint16_t over_time);
     void (*timer_stop_cb)(void);
+    uint32_t (*get_time_us)(void);
+    uint16_t gap_ms;
+    uint16_t busy_delay;
+    /* Time of one character on the line, 0: Unknown baud. */
+    uint32_t char_us;
+    /* get_time_us at the last transmission. */
+    uint32_t tx_us;
+    mbrm_protocol_stat_t stat;
     void (*send_data)(uint8_t);
 } mbrm_protocol_private_t;
 
@@ -109,10 +162,19 @@ typedef struct
     /* PUBLIC */
     void (*init)(const mbrm_init_cfg *);
     uint8_t (*send_cmd)(mbrm_unit_cfg_t *q);
+    int (*cancel)(uint32_t id);
     void (*receive)(const uint8_t *, uint16_t);
     void (*timer_over)(void);
     mbrm_protocol_status_t (*get_status)(void);
+    uint8_t (*get_free)(void);
     const mbrm_communication_unit_t *(*get_unit_in_queue)(uint8_t);
+    uint16_t (*get_crc)(const uint8_t *, uint16_t);
+    int (*check_frame)(const uint8_t *data, uint16_t len);
+    uint16_t (*encode)(const mbrm_unit_cfg_t *q, uint8_t *buf);
+    uint32_t (*get_time_us)(void);
+    void (*get_stat)(mbrm_protocol_stat_t *stat);
+    uint32_t (*gap_us)(uint32_t baud, uint8_t char_bits);
+    mbrm_protocol_private_t *(*select)(mbrm_protocol_private_t *ctx);
 } mbrm_protocol_t;
 
 const mbrm_protocol_t *mbrm_get_protocol(void);
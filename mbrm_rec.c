@@ -0,0 +1,170 @@
+/*
+ * mbrm_rec.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+#include "mbrm_rec.h"
+
+#if MBRM_REC_SWITCH
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static mbrm_rec_t mbrm_rec;
+static mbrm_rec_private_t *mbrm_rec_priv;
+
+/**
+ * @brief Map the ring file, creating it when missing. An existing ring of
+ *        the same capacity is continued so history survives restarts.
+ * @param path
+ * @param capacity Records kept.
+ * @return 0 Succeed; -1: Parameter err; 2: File or mmap fail.
+ */
+static int _mbrm_rec_open(const char *path, uint32_t capacity)
+{
+    size_t len = sizeof(mbrm_rec_header_t) + (size_t)capacity * sizeof(mbrm_rec_record_t);
+    void *map;
+    int fd;
+
+    if (path == NULL || capacity == 0)
+    {
+        mbrm_log_e("rec_open: Parameter err.\r\n");
+        return -1;
+    }
+    mbrm_rec_priv = (mbrm_rec_private_t *)mbrm_rec.priv;
+    if (mbrm_rec_priv->header != NULL)
+    {
+        mbrm_rec.close();
+    }
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, len) != 0)
+    {
+        mbrm_log_e("rec_open: File fail.\r\n");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return 2;
+    }
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        mbrm_log_e("rec_open: Mmap fail.\r\n");
+        close(fd);
+        return 2;
+    }
+
+    mbrm_rec_priv->fd = fd;
+    mbrm_rec_priv->map_len = len;
+    mbrm_rec_priv->header = (mbrm_rec_header_t *)map;
+    mbrm_rec_priv->records = (mbrm_rec_record_t *)((uint8_t *)map + sizeof(mbrm_rec_header_t));
+
+    if (memcmp(mbrm_rec_priv->header->magic, MBRM_REC_MAGIC, 8) != 0 ||
+            mbrm_rec_priv->header->record_size != sizeof(mbrm_rec_record_t) ||
+            mbrm_rec_priv->header->capacity != capacity)
+    {
+        memset(map, 0, len);
+        mbrm_rec_priv->header->record_size = sizeof(mbrm_rec_record_t);
+        mbrm_rec_priv->header->capacity = capacity;
+        memcpy(mbrm_rec_priv->header->magic, MBRM_REC_MAGIC, 8);
+    }
+    return 0;
+}
+
+/**
+ * @brief Append a record. Only stores into the mapping, clock_gettime goes
+ *        through the vDSO; the kernel writes the pages back, also after a crash.
+ * @param unit
+ * @param rtt_us From the first transmission to the pop.
+ */
+static void _mbrm_rec_record(const mbrm_communication_unit_t *unit, uint32_t rtt_us)
+{
+    mbrm_rec_record_t *r;
+    struct timespec ts;
+    uint64_t idx;
+
+    if (mbrm_rec_priv == NULL || mbrm_rec_priv->header == NULL || unit == NULL)
+    {
+        return;
+    }
+    idx = __atomic_fetch_add(&mbrm_rec_priv->header->head, 1, __ATOMIC_RELAXED);
+    r = &mbrm_rec_priv->records[idx % mbrm_rec_priv->header->capacity];
+
+    /* Readers skip the slot while it is rewritten. */
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r->time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    r->rtt_us = rtt_us;
+    r->register_addr = unit->cfg.register_addr;
+    r->count = unit->cfg.len;
+    r->slave_addr = unit->cfg.slave_addr;
+    r->cmd = unit->cfg.cmd;
+    r->status = unit->status;
+    r->retries = (unit->repeat > 0) ? unit->repeat - 1 : 0;
+    r->exception = unit->exception;
+    __atomic_store_n(&r->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_rec_close(void)
+{
+    if (mbrm_rec_priv == NULL || mbrm_rec_priv->header == NULL)
+    {
+        return;
+    }
+    msync(mbrm_rec_priv->header, mbrm_rec_priv->map_len, MS_SYNC);
+    munmap(mbrm_rec_priv->header, mbrm_rec_priv->map_len);
+    close(mbrm_rec_priv->fd);
+    mbrm_rec_priv->header = NULL;
+    mbrm_rec_priv->records = NULL;
+}
+
+static mbrm_rec_t mbrm_rec =
+{
+    .open = _mbrm_rec_open,
+    .record = _mbrm_rec_record,
+    .close = _mbrm_rec_close,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_rec_t *mbrm_get_rec(void)
+{
+    return &mbrm_rec;
+}
+
+#endif /* MBRM_REC_SWITCH */
@@ -0,0 +1,93 @@
+/*
+ * mbrm_rec.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_REC_H_
+#define _MODBUS_RTU_MASTER_MBRM_REC_H_
+
+#include <stdint.h>
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+
+#define MBRM_REC_MAGIC "MBRMREC2"
+
+/**
+ * One finished transaction, 32 bytes. seq is written last and is the
+ * record's position in the ring plus 1, 0 marks a slot never written.
+ */
+typedef struct
+{
+    /* 64 bit so it does not wrap onto a live slot on long runs. */
+    uint64_t seq;
+    /* CLOCK_REALTIME at the pop. */
+    uint64_t time_ns;
+    uint32_t rtt_us;
+    uint16_t register_addr;
+    uint16_t count;
+    uint8_t slave_addr;
+    uint8_t cmd;
+    uint8_t status;
+    uint8_t retries;
+    uint8_t exception;
+    uint8_t reserved[3];
+} mbrm_rec_record_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t record_size;
+    uint32_t capacity;
+    /* Records ever written, the next one goes to head % capacity. */
+    uint64_t head;
+    uint8_t reserved[40];
+} mbrm_rec_header_t;
+
+typedef struct
+{
+    int fd;
+    size_t map_len;
+    mbrm_rec_header_t *header;
+    mbrm_rec_record_t *records;
+} mbrm_rec_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_rec_private_t)];
+
+    /* PUBLIC */
+    int (*open)(const char *path, uint32_t capacity);
+    void (*record)(const mbrm_communication_unit_t *unit, uint32_t rtt_us);
+    void (*close)(void);
+} mbrm_rec_t;
+
+const mbrm_rec_t *mbrm_get_rec(void);
+
+#if MBRM_REC_SWITCH
+    #define MBRM_REC(_unit_, _rtt_) mbrm_get_rec()->record(_unit_, _rtt_)
+#else
+    #define MBRM_REC(_unit_, _rtt_)
+#endif
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_REC_H_ */
@@ -0,0 +1,253 @@
+/*
+ * mbrm_regmap.hpp
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_REGMAP_HPP_
+#define _MODBUS_RTU_MASTER_MBRM_REGMAP_HPP_
+
+/**
+ * C++20 register maps declared as types. A field fixes its address, type,
+ * word and byte order and scaling at compile time, a block groups the
+ * fields of one transaction. The 0x03 poll frame and its CRC are
+ * constants, decode and encode are straight-line code for each field,
+ * and overlapping or oversized blocks fail to compile.
+ *
+ *   using temp = mbrm::field<0x10, int16_t, MBRM_DEV_32_1234, 0.1>;
+ *   using flow = mbrm::field<0x12, float, MBRM_DEV_32_3412>;
+ *   using meter = mbrm::block<1, 0x03, temp, flow>;
+ *
+ *   static meter::buffer rx;
+ *   mbrm_unit_cfg_t cfg = meter::unit(rx.data());
+ *   cfg.pop_sigingal = on_pop;
+ *   mbrm_get_protocol()->send_cmd(&cfg);
+ *   ...
+ *   double t = meter::value<temp>(rx.data());
+ */
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+
+extern "C" {
+#include "mbrm_protocol.h"
+#include "mbrm_device.h"
+}
+
+namespace mbrm
+{
+
+namespace detail
+{
+
+constexpr uint16_t crc16(const uint8_t *data, std::size_t len) noexcept
+{
+    uint16_t crc = 0xFFFF;
+
+    for (std::size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/* Position on the wire of byte k (LSB first) of an element of words registers. */
+constexpr std::size_t wire_pos(mbrm_device_32_mode_t mode, std::size_t words, std::size_t k) noexcept
+{
+    bool word_hi = (mode == MBRM_DEV_32_1234 || mode == MBRM_DEV_32_2143);
+    bool byte_hi = (mode == MBRM_DEV_32_1234 || mode == MBRM_DEV_32_3412);
+
+    return (word_hi ? words - 1 - k / 2 : k / 2) * 2 + (byte_hi ? 1 - k % 2 : k % 2);
+}
+
+template <std::size_t N> struct uint_of;
+template <> struct uint_of<2> { using type = uint16_t; };
+template <> struct uint_of<4> { using type = uint32_t; };
+template <> struct uint_of<8> { using type = uint64_t; };
+
+} // namespace detail
+
+/**
+ * One value of Addr and the registers after it. Mode orders words and
+ * bytes like mode_32 of the C layer; for 16 bit types 1234 and 3412 are
+ * big endian, 2143 and 4321 swap the bytes. value() is raw * Scale + Offset.
+ */
+template <uint16_t Addr, typename T, mbrm_device_32_mode_t Mode = MBRM_DEV_32_1234,
+          double Scale = 1.0, double Offset = 0.0>
+struct field
+{
+    static_assert(std::is_arithmetic_v<T> && (sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8),
+                  "A field is a 16, 32 or 64 bit number");
+
+    using value_type = T;
+    static constexpr uint16_t addr = Addr;
+    static constexpr uint16_t words = sizeof(T) / 2;
+
+    static constexpr T decode(const uint8_t *p) noexcept
+    {
+        typename detail::uint_of<sizeof(T)>::type raw = 0;
+
+        for (std::size_t k = 0; k < sizeof(T); k++)
+        {
+            raw |= static_cast<decltype(raw)>(p[detail::wire_pos(Mode, words, k)]) << (8 * k);
+        }
+        return std::bit_cast<T>(raw);
+    }
+
+    static constexpr void encode(T v, uint8_t *p) noexcept
+    {
+        auto raw = std::bit_cast<typename detail::uint_of<sizeof(T)>::type>(v);
+
+        for (std::size_t k = 0; k < sizeof(T); k++)
+        {
+            p[detail::wire_pos(Mode, words, k)] = static_cast<uint8_t>(raw >> (8 * k));
+        }
+    }
+
+    static constexpr double scaled(T raw) noexcept
+    {
+        return static_cast<double>(raw) * Scale + Offset;
+    }
+};
+
+/**
+ * The fields read (0x03) or written (0x10) by one transaction with Slave.
+ * A write block must cover its range without gaps, the registers in a gap
+ * would be overwritten.
+ */
+template <uint8_t Slave, uint8_t Cmd, typename... Fields>
+class block
+{
+    static_assert(sizeof...(Fields) > 0, "A block needs a field");
+    static_assert(Cmd == 0x03 || Cmd == 0x10, "Blocks are read with 0x03 or written with 0x10");
+    static_assert(Slave >= 1 && Slave <= 247, "Slave address out of range");
+
+    static constexpr uint32_t _end = std::max({static_cast<uint32_t>(Fields::addr + Fields::words)...});
+    static constexpr uint32_t _words = (0u + ... + Fields::words);
+
+    static constexpr bool _disjoint() noexcept
+    {
+        constexpr std::array<uint32_t, sizeof...(Fields)> lo = {Fields::addr...};
+        constexpr std::array<uint32_t, sizeof...(Fields)> hi = {(Fields::addr + Fields::words)...};
+
+        for (std::size_t i = 0; i < lo.size(); i++)
+        {
+            for (std::size_t k = i + 1; k < lo.size(); k++)
+            {
+                if (lo[i] < hi[k] && lo[k] < hi[i])
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static constexpr std::array<uint8_t, 8> _read_frame() noexcept
+    {
+        std::array<uint8_t, 8> f = {Slave, Cmd, 0, 0, 0, 0, 0, 0};
+
+        f[2] = start >> 8;
+        f[3] = start & 0xff;
+        f[4] = count >> 8;
+        f[5] = count & 0xff;
+        uint16_t crc = detail::crc16(f.data(), 6);
+        f[6] = crc & 0xff;
+        f[7] = crc >> 8;
+        return f;
+    }
+
+public:
+    static constexpr uint16_t start = std::min({Fields::addr...});
+    static constexpr uint16_t count = _end - start;
+
+    static_assert(_end <= 0x10000, "Block passes the last register");
+    static_assert(count <= (Cmd == 0x03 ? 125 : 123), "Block does not fit in one frame");
+    static_assert(_disjoint(), "Fields overlap");
+    static_assert(Cmd != 0x10 || _words == count, "Write block has a gap");
+
+    using buffer = std::array<uint8_t, 2 * count>;
+    using values = std::tuple<typename Fields::value_type...>;
+
+    /* Poll frame of a read block, CRC included. */
+    static constexpr std::array<uint8_t, 8> frame = _read_frame();
+
+    template <typename F>
+    static constexpr std::size_t offset() noexcept
+    {
+        static_assert((std::is_same_v<F, Fields> || ...), "Field is not in the block");
+        return 2 * (F::addr - start);
+    }
+
+    template <typename F>
+    static constexpr typename F::value_type get(const uint8_t *data) noexcept
+    {
+        return F::decode(data + offset<F>());
+    }
+
+    template <typename F>
+    static constexpr double value(const uint8_t *data) noexcept
+    {
+        return F::scaled(get<F>(data));
+    }
+
+    static constexpr values decode(const uint8_t *data) noexcept
+    {
+        return {get<Fields>(data)...};
+    }
+
+    static constexpr void encode(uint8_t *data, typename Fields::value_type... v) noexcept
+    {
+        (Fields::encode(v, data + offset<Fields>()), ...);
+    }
+
+    /**
+     * Unit for send_cmd, data holds a buffer and must live until the unit
+     * pops. Read blocks send the constant frame. repeat_max, over_time and
+     * pop_sigingal are left to the caller.
+     */
+    static mbrm_unit_cfg_t unit(uint8_t *data) noexcept
+    {
+        mbrm_unit_cfg_t cfg = {};
+
+        cfg.slave_addr = Slave;
+        cfg.cmd = Cmd;
+        cfg.register_addr = start;
+        cfg.len = static_cast<uint8_t>(count);
+        cfg.data = data;
+        cfg.frame = (Cmd == 0x03) ? frame.data() : nullptr;
+        return cfg;
+    }
+};
+
+} // namespace mbrm
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_REGMAP_HPP_ */
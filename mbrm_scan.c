@@ -0,0 +1,365 @@
+/*
+ * mbrm_scan.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_scan.h"
+
+static mbrm_scan_t mbrm_scan;
+static mbrm_scan_private_t *mbrm_scan_priv;
+
+static void _mbrm_scan_pop_sigingal(uint8_t poped);
+
+/**
+ * @brief Probe timeout: request and answer on the wire plus turnaround.
+ * @param num Registers read.
+ * @return uint16_t ms
+ */
+static uint16_t _mbrm_scan_over_time(uint16_t num)
+{
+    uint32_t chars = 8 + 5 + 2 * num + 7;   /* request, answer, 2 x 3.5 char gap */
+    uint32_t ms = (chars * mbrm_scan_priv->cfg.char_bits * 1000 + mbrm_scan_priv->cfg.baud - 1) / mbrm_scan_priv->cfg.baud;
+
+    return ms + mbrm_scan_priv->cfg.turnaround;
+}
+
+/**
+ * @brief
+ * @param slave_addr
+ * @param register_addr
+ * @param num
+ * @return 0 Succeed; other: Queue is full.
+ */
+static uint8_t _mbrm_scan_probe(uint8_t slave_addr, uint16_t register_addr, uint16_t num)
+{
+    mbrm_unit_cfg_t cfg =
+    {
+        .cmd = 0x03,
+        .slave_addr = slave_addr,
+        .register_addr = register_addr,
+        .len = num,
+        .repeat_max = 1,
+        .over_time = _mbrm_scan_over_time(num),
+        .flags = MBRM_UNIT_FLAG_EXACT_TIME,
+        .data = mbrm_scan_priv->rx_buf,
+        .pop_sigingal = _mbrm_scan_pop_sigingal,
+    };
+    return mbrm_scan_priv->protocol->send_cmd(&cfg);
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_scan_finish(void)
+{
+    mbrm_scan_priv->state = MBRM_SCAN_IDLE;
+    mbrm_log_i("Scan finish, %d slave found.\r\n", mbrm_scan_priv->result_num);
+    if (mbrm_scan_priv->cfg.done_cb != NULL)
+    {
+        mbrm_scan_priv->cfg.done_cb(mbrm_scan_priv->results, mbrm_scan_priv->result_num);
+    }
+}
+
+/**
+ * @brief Issue the next probe of the scan.
+ * @param
+ */
+static void _mbrm_scan_next(void)
+{
+    uint8_t ret = 0;
+    const mbrm_scan_window_t *win;
+
+    switch (mbrm_scan_priv->state)
+    {
+    case MBRM_SCAN_PRESENCE:
+    case MBRM_SCAN_VERIFY:
+        if (mbrm_scan_priv->addr <= mbrm_scan_priv->cfg.last_addr)
+        {
+            ret = _mbrm_scan_probe(mbrm_scan_priv->addr, mbrm_scan_priv->cfg.probe_register, 1);
+            break;
+        }
+        mbrm_scan_priv->state = MBRM_SCAN_WINDOW;
+        mbrm_scan_priv->result_pos = 0;
+        mbrm_scan_priv->window_pos = 0;
+        /* fall through */
+
+    case MBRM_SCAN_WINDOW:
+        while (mbrm_scan_priv->result_pos < mbrm_scan_priv->result_num &&
+                mbrm_scan_priv->window_pos >= mbrm_scan_priv->cfg.window_num)
+        {
+            mbrm_scan_priv->result_pos++;
+            mbrm_scan_priv->window_pos = 0;
+        }
+        if (mbrm_scan_priv->result_pos >= mbrm_scan_priv->result_num)
+        {
+            _mbrm_scan_finish();
+            return;
+        }
+        win = &mbrm_scan_priv->cfg.windows[mbrm_scan_priv->window_pos];
+        ret = _mbrm_scan_probe(mbrm_scan_priv->results[mbrm_scan_priv->result_pos].slave_addr,
+                               win->register_addr, win->num);
+        break;
+
+    default:
+        return;
+    }
+
+    if (ret != 0)
+    {
+        mbrm_log_e("Scan abort, queue is full.\r\n");
+        _mbrm_scan_finish();
+    }
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_scan_add_result(void)
+{
+    mbrm_scan_result_t *result;
+
+    if (mbrm_scan_priv->result_num >= MBRM_SCAN_RESULT_MAX)
+    {
+        mbrm_log_w("Scan result is full, drop slave %d.\r\n", mbrm_scan_priv->addr);
+        return;
+    }
+    result = &mbrm_scan_priv->results[mbrm_scan_priv->result_num++];
+    result->slave_addr = mbrm_scan_priv->addr;
+    result->window_mask = 0;
+    mbrm_log_i("Scan found slave %d.\r\n", mbrm_scan_priv->addr);
+}
+
+/**
+ * @brief Any answer with a good CRC, exceptions included, means a slave is there.
+ * @param poped
+ */
+static void _mbrm_scan_pop_sigingal(uint8_t poped)
+{
+    const mbrm_communication_unit_t *unit = mbrm_scan_priv->protocol->get_unit_in_queue(poped);
+    uint8_t present = (unit->status == MBRM_QUEUE_STATUS_FINISH || unit->status == MBRM_QUEUE_STATUS_ERROR);
+
+    switch (mbrm_scan_priv->state)
+    {
+    case MBRM_SCAN_PRESENCE:
+        if (!present)
+        {
+            mbrm_scan_priv->addr++;
+        }
+        else
+        {
+            mbrm_scan_priv->state = MBRM_SCAN_VERIFY;
+            mbrm_scan_priv->verified = 0;
+        }
+        break;
+
+    case MBRM_SCAN_VERIFY:
+        if (present && ++mbrm_scan_priv->verified < mbrm_scan_priv->cfg.verify)
+        {
+            break;
+        }
+        if (present)
+        {
+            _mbrm_scan_add_result();
+        }
+        mbrm_scan_priv->state = MBRM_SCAN_PRESENCE;
+        mbrm_scan_priv->addr++;
+        break;
+
+    case MBRM_SCAN_WINDOW:
+        if (unit->status == MBRM_QUEUE_STATUS_FINISH)
+        {
+            mbrm_scan_priv->results[mbrm_scan_priv->result_pos].window_mask |= 1UL << mbrm_scan_priv->window_pos;
+        }
+        mbrm_scan_priv->window_pos++;
+        break;
+
+    default:
+        /* Stopped. */
+        return;
+    }
+    _mbrm_scan_next();
+}
+
+/**
+ * @brief Start a scan, probes are chained from the pop signal so the mutex
+ *        given to init must be recursive.
+ * @param cfg
+ * @return 0 Succeed; -1: Parameter err; 1: Scan is running; 3: Queue is full.
+ */
+static int _mbrm_scan_start(const mbrm_scan_cfg_t *cfg)
+{
+    mbrm_scan_priv = (mbrm_scan_private_t *)mbrm_scan.priv;
+
+    if (cfg == NULL || cfg->first_addr < 1 || cfg->last_addr > 247 || cfg->first_addr > cfg->last_addr ||
+            cfg->window_num > 32 || (cfg->window_num > 0 && cfg->windows == NULL))
+    {
+        mbrm_log_e("scan_start: Parameter err.\r\n");
+        return -1;
+    }
+    if (mbrm_scan_priv->state != MBRM_SCAN_IDLE)
+    {
+        mbrm_log_w("scan_start: Scan is running.\r\n");
+        return 1;
+    }
+
+    memset(mbrm_scan_priv, 0, sizeof(mbrm_scan_private_t));
+    mbrm_scan_priv->protocol = mbrm_get_protocol();
+    mbrm_scan_priv->cfg = *cfg;
+    if (mbrm_scan_priv->cfg.baud == 0)
+    {
+        mbrm_scan_priv->cfg.baud = 9600;
+    }
+    if (mbrm_scan_priv->cfg.char_bits == 0)
+    {
+        mbrm_scan_priv->cfg.char_bits = 11;
+    }
+    if (mbrm_scan_priv->cfg.turnaround == 0)
+    {
+        mbrm_scan_priv->cfg.turnaround = 10;
+    }
+    if (mbrm_scan_priv->cfg.verify == 0)
+    {
+        mbrm_scan_priv->cfg.verify = 1;
+    }
+    mbrm_scan_priv->addr = cfg->first_addr;
+    mbrm_scan_priv->state = MBRM_SCAN_PRESENCE;
+
+    if (_mbrm_scan_probe(mbrm_scan_priv->addr, mbrm_scan_priv->cfg.probe_register, 1) != 0)
+    {
+        mbrm_scan_priv->state = MBRM_SCAN_IDLE;
+        return 3;
+    }
+    return 0;
+}
+
+/**
+ * @brief The probe on the bus completes, no new one is sent and done_cb is not called.
+ * @param
+ */
+static void _mbrm_scan_stop(void)
+{
+    if (mbrm_scan_priv != NULL)
+    {
+        mbrm_scan_priv->state = MBRM_SCAN_IDLE;
+    }
+}
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+static mbrm_scan_state_t _mbrm_scan_get_state(void)
+{
+    return (mbrm_scan_priv == NULL) ? MBRM_SCAN_IDLE : mbrm_scan_priv->state;
+}
+
+/**
+ * @brief
+ * @param results
+ * @return Number of slaves found.
+ */
+static uint8_t _mbrm_scan_get_result(const mbrm_scan_result_t **results)
+{
+    if (mbrm_scan_priv == NULL)
+    {
+        return 0;
+    }
+    if (results != NULL)
+    {
+        *results = mbrm_scan_priv->results;
+    }
+    return mbrm_scan_priv->result_num;
+}
+
+/**
+ * @brief Build a device for dev_register from a scan result, one 0x03
+ *        command per answered window.
+ * @param result
+ * @param info
+ * @param cmds Storage of the command list.
+ * @param cmd_max
+ * @param pool Register storage shared by the commands.
+ * @param pool_len
+ * @return Number of commands; -1: Parameter err.
+ */
+static int _mbrm_scan_make_info(const mbrm_scan_result_t *result, mbrm_device_info_t *info,
+                                mbrm_device_cmd_t *cmds, uint8_t cmd_max, uint16_t *pool, uint16_t pool_len)
+{
+    const mbrm_scan_window_t *win;
+    uint8_t i, num = 0;
+
+    if (result == NULL || info == NULL || (cmd_max > 0 && (cmds == NULL || pool == NULL)))
+    {
+        return -1;
+    }
+
+    memset(info, 0, sizeof(mbrm_device_info_t));
+    snprintf(info->name, MBRM_DEVICE_NAME_LENTH, "s%d", result->slave_addr);
+    info->slave_addr = result->slave_addr;
+    info->mode_16 = MBRM_DEV_16_12;
+    info->mode_32 = MBRM_DEV_32_1234;
+    info->cmd_list = cmds;
+
+    for (i = 0; mbrm_scan_priv != NULL && i < mbrm_scan_priv->cfg.window_num && num < cmd_max; i++)
+    {
+        win = &mbrm_scan_priv->cfg.windows[i];
+        if (!(result->window_mask & (1UL << i)) || win->num > pool_len)
+        {
+            continue;
+        }
+        memset(&cmds[num], 0, sizeof(mbrm_device_cmd_t));
+        cmds[num].cmd = 0x03;
+        cmds[num].register_addr = win->register_addr;
+        cmds[num].num = win->num;
+        cmds[num].type = MBRM_TYPE_16;
+        cmds[num].data = pool;
+        pool += win->num;
+        pool_len -= win->num;
+        num++;
+    }
+    info->cmd_num = num;
+    return num;
+}
+
+static mbrm_scan_t mbrm_scan =
+{
+    .start = _mbrm_scan_start,
+    .stop = _mbrm_scan_stop,
+    .get_state = _mbrm_scan_get_state,
+    .get_result = _mbrm_scan_get_result,
+    .make_info = _mbrm_scan_make_info,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_scan_t *mbrm_get_scan(void)
+{
+    return &mbrm_scan;
+}
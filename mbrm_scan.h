@@ -0,0 +1,107 @@
+/*
+ * mbrm_scan.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_SCAN_H_
+#define _MODBUS_RTU_MASTER_MBRM_SCAN_H_
+
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+#include "mbrm_device.h"
+
+typedef struct
+{
+    uint16_t register_addr;
+    uint16_t num;
+} mbrm_scan_window_t;
+
+typedef struct
+{
+    uint8_t slave_addr;
+    /* Bit i set: windows[i] of the scan configuration was answered. */
+    uint32_t window_mask;
+} mbrm_scan_result_t;
+
+typedef struct
+{
+    /* Address range, 1 ~ 247. */
+    uint8_t first_addr;
+    uint8_t last_addr;
+
+    /* Line settings used to derive the probe timeout. */
+    uint32_t baud;
+    uint8_t char_bits;          /* def: 11 */
+    uint16_t turnaround;        /* Slave turnaround in ms(def: 10). */
+
+    /* Extra probes a hit must answer before it is accepted, at least 1(def: 1). */
+    uint8_t verify;
+    uint16_t probe_register;
+
+    /* Optional register windows probed on every slave found, max 32. */
+    const mbrm_scan_window_t *windows;
+    uint8_t window_num;
+
+    void (*done_cb)(const mbrm_scan_result_t *results, uint8_t num);
+} mbrm_scan_cfg_t;
+
+typedef enum
+{
+    MBRM_SCAN_IDLE = 0,
+    MBRM_SCAN_PRESENCE,
+    MBRM_SCAN_VERIFY,
+    MBRM_SCAN_WINDOW,
+} mbrm_scan_state_t;
+
+typedef struct
+{
+    mbrm_scan_state_t state;
+    mbrm_scan_cfg_t cfg;
+    uint16_t over_time;
+    uint8_t addr;
+    uint8_t verified;
+    uint8_t result_pos;
+    uint8_t window_pos;
+    uint8_t result_num;
+    mbrm_scan_result_t results[MBRM_SCAN_RESULT_MAX];
+    uint8_t rx_buf[256];
+    const mbrm_protocol_t *protocol;
+} mbrm_scan_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_scan_private_t)];
+
+    /* PUBLIC */
+    int (*start)(const mbrm_scan_cfg_t *cfg);
+    void (*stop)(void);
+    mbrm_scan_state_t (*get_state)(void);
+    uint8_t (*get_result)(const mbrm_scan_result_t **results);
+    int (*make_info)(const mbrm_scan_result_t *result, mbrm_device_info_t *info,
+                     mbrm_device_cmd_t *cmds, uint8_t cmd_max, uint16_t *pool, uint16_t pool_len);
+} mbrm_scan_t;
+
+const mbrm_scan_t *mbrm_get_scan(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_SCAN_H_ */
@@ -0,0 +1,588 @@
+/*
+ * mbrm_shard.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include "mbrm_shard.h"
+
+#if MBRM_SHARD_SWITCH
+
+#if !MBRM_LOOP_SWITCH
+    #error "MBRM_SHARD_SWITCH needs MBRM_LOOP_SWITCH"
+#endif
+
+#if (MBRM_SHARD_RING_DEPTH & (MBRM_SHARD_RING_DEPTH - 1)) != 0
+    #error "MBRM_SHARD_RING_DEPTH must be a power of 2"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static mbrm_shard_t mbrm_shard;
+static mbrm_shard_private_t *mbrm_shard_priv;
+
+/**
+ * @brief
+ * @param fd
+ */
+static void _mbrm_shard_signal(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0)
+    {
+        mbrm_log_w("Shard signal fail.\r\n");
+    }
+}
+
+/**
+ * @brief
+ * @param fd
+ */
+static void _mbrm_shard_clear(int fd)
+{
+    uint64_t v;
+
+    if (read(fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+    {
+        mbrm_log_w("Shard clear fail.\r\n");
+    }
+}
+
+/**
+ * @brief
+ * @param type
+ * @return
+ */
+static uint8_t _mbrm_shard_type_size(mbrm_device_type_t type)
+{
+    switch (type)
+    {
+    case MBRM_TYPE_32:
+    case MBRM_TYPE_INT32:
+    case MBRM_TYPE_UINT32:
+    case MBRM_TYPE_FLOAT32:
+        return 4;
+    case MBRM_TYPE_FLOAT64:
+    case MBRM_TYPE_INT64:
+        return 8;
+    default:
+        return 2;
+    }
+}
+
+/**
+ * @brief Queue a completion for the caller, in the shard. The ring cannot
+ *        be full, send keeps fewer requests than its depth outstanding.
+ * @param ctx
+ * @param tag
+ * @param ret
+ * @param status
+ * @param pcmd Command whose data is copied, NULL: None.
+ */
+static void _mbrm_shard_post(mbrm_shard_ctx_t *ctx, uint32_t tag, int8_t ret, mbrm_queue_status_t status,
+                             const mbrm_device_cmd_t *pcmd)
+{
+    uint32_t head = ctx->rings.done_ring.head;
+    mbrm_shard_done_t *done = &ctx->rings.done[head & (MBRM_SHARD_RING_DEPTH - 1)];
+    uint32_t len = 0;
+
+    if (pcmd != NULL)
+    {
+        len = (uint32_t)pcmd->num * _mbrm_shard_type_size(pcmd->type);
+        len = (len > MBRM_SHARD_DATA_MAX) ? MBRM_SHARD_DATA_MAX : len;
+        memcpy(done->data, pcmd->data, len);
+    }
+    done->tag = tag;
+    done->shard = ctx->id;
+    done->ret = ret;
+    done->status = status;
+    done->len = len;
+    __atomic_store_n(&ctx->rings.done_ring.head, head + 1, __ATOMIC_RELEASE);
+    _mbrm_shard_signal(mbrm_shard_priv->done_efd);
+}
+
+/**
+ * @brief complete_cb of the requests made by the shard.
+ * @param status
+ * @param data
+ * @param user_param Inflight slot.
+ */
+static void _mbrm_shard_complete(mbrm_queue_status_t status, void *data, void *user_param)
+{
+    mbrm_shard_inflight_t *slot = (mbrm_shard_inflight_t *)user_param;
+
+    (void)data;
+    _mbrm_shard_post(slot->ctx, slot->tag, 0, status, slot->pcmd);
+    slot->used = 0;
+}
+
+/**
+ * @brief Move requests from the ring to the RTU queue while it has room,
+ *        in the shard. A request that does not fit stays in the ring.
+ * @param ctx
+ */
+static void _mbrm_shard_pull(mbrm_shard_ctx_t *ctx)
+{
+    const mbrm_device_class_t *dev = get_mbrm_devive_obj();
+    mbrm_shard_rings_t *rings = &ctx->rings;
+    uint32_t tail = rings->req_ring.tail;
+    mbrm_shard_inflight_t *slot;
+    mbrm_device_info_t *info;
+    mbrm_shard_req_t *req;
+    uint32_t size;
+    uint8_t i;
+    int ret;
+
+    while (tail != __atomic_load_n(&rings->req_ring.head, __ATOMIC_ACQUIRE))
+    {
+        req = &rings->req[tail & (MBRM_SHARD_RING_DEPTH - 1)];
+        for (i = 0, slot = NULL; i < MBRM_COMMUNICATION_QUEUE_MAX_LENTH; i++)
+        {
+            if (!ctx->inflight[i].used)
+            {
+                slot = &ctx->inflight[i];
+                break;
+            }
+        }
+        if (slot == NULL)
+        {
+            break;
+        }
+
+        info = dev->dev_get_info(req->name);
+        if (info == NULL || req->cmd >= info->cmd_num)
+        {
+            _mbrm_shard_post(ctx, req->tag, (info == NULL) ? 1 : -1, MBRM_QUEUE_STATUS_ERROR, NULL);
+            tail++;
+            continue;
+        }
+        slot->tag = req->tag;
+        slot->ctx = ctx;
+        slot->pcmd = &info->cmd_list[req->cmd];
+        if (req->len > 0)
+        {
+            size = (uint32_t)slot->pcmd->num * _mbrm_shard_type_size(slot->pcmd->type);
+            memcpy(slot->pcmd->data, req->data, (req->len < size) ? req->len : size);
+        }
+
+        mbrm_device_req_t r =
+        {
+            .complete_cb = _mbrm_shard_complete,
+            .user_param = slot,
+        };
+        /* Taken first, a request may complete before dev_request returns. */
+        slot->used = 1;
+        ret = dev->dev_request(req->name, req->cmd, &r, &slot->handle);
+        if (ret != 0)
+        {
+            slot->used = 0;
+        }
+        if (ret == 3)
+        {
+            /* Retried once a unit pops. */
+            break;
+        }
+        if (ret != 0)
+        {
+            _mbrm_shard_post(ctx, req->tag, (int8_t)ret, MBRM_QUEUE_STATUS_ERROR, NULL);
+        }
+        tail++;
+    }
+    __atomic_store_n(&rings->req_ring.tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief
+ * @param ctx
+ * @return Number of requests of the shard in the RTU queue.
+ */
+static uint8_t _mbrm_shard_inflight(const mbrm_shard_ctx_t *ctx)
+{
+    uint8_t i, n = 0;
+
+    for (i = 0; i < MBRM_COMMUNICATION_QUEUE_MAX_LENTH; i++)
+    {
+        n += ctx->inflight[i].used;
+    }
+    return n;
+}
+
+/**
+ * @brief Detach the first num devices of a shard that has no thread, the
+ *        selection of the caller is restored.
+ * @param ctx
+ * @param num
+ */
+static void _mbrm_shard_detach(mbrm_shard_ctx_t *ctx, uint8_t num)
+{
+    const mbrm_device_class_t *dev = get_mbrm_devive_obj();
+    mbrm_bus_t *prev = dev->bus_select(&ctx->lb.bus);
+    uint8_t i;
+
+    for (i = 0; i < num; i++)
+    {
+        dev->dev_detach(ctx->bus.devs[i].name);
+    }
+    dev->bus_select(prev);
+}
+
+/**
+ * @brief Set up the bus of a shard and register its devices, on the thread
+ *        calling start. The selection of the caller is restored.
+ * @param ctx
+ * @return 0 Succeed; -1: Parameter err; 1: Target already exists; 2: Memory alloc fail.
+ */
+static int _mbrm_shard_setup(mbrm_shard_ctx_t *ctx)
+{
+    const mbrm_device_class_t *dev = get_mbrm_devive_obj();
+    mbrm_bus_t *prev = dev->bus_selected();
+    mbrm_init_cfg init_cfg;
+    uint8_t i;
+    int ret = 0;
+
+    memset(&init_cfg, 0, sizeof(init_cfg));
+    init_cfg.bus_id = ctx->id;
+    mbrm_get_loop()->init(&ctx->lb, &ctx->bus.loop, &init_cfg);
+    dev->init(&init_cfg);
+    for (i = 0; i < ctx->bus.dev_num && ret == 0; i++)
+    {
+        ret = dev->dev_register(&ctx->bus.devs[i]);
+    }
+    dev->bus_select(prev);
+    if (ret != 0)
+    {
+        mbrm_log_e("Shard %d: Device \"%s\" register fail.\r\n", ctx->id, ctx->bus.devs[i - 1].name);
+        _mbrm_shard_detach(ctx, i - 1);
+    }
+    return ret;
+}
+
+/**
+ * @brief Body of a shard thread. Its bus stays selected on the thread, on
+ *        stop the requests in the RTU queue are cancelled and the devices
+ *        detached once they popped.
+ * @param arg Context of the shard.
+ * @return
+ */
+static void *_mbrm_shard_run(void *arg)
+{
+    mbrm_shard_ctx_t *ctx = (mbrm_shard_ctx_t *)arg;
+    const mbrm_device_class_t *dev = get_mbrm_devive_obj();
+    const mbrm_loop_t *loop = mbrm_get_loop();
+    uint8_t stop, cancelled = 0;
+    uint8_t i;
+
+    dev->bus_select(&ctx->lb.bus);
+
+    for (;;)
+    {
+        stop = __atomic_load_n(&ctx->rings.stop, __ATOMIC_ACQUIRE);
+        if (stop && !cancelled)
+        {
+            for (i = 0; i < MBRM_COMMUNICATION_QUEUE_MAX_LENTH; i++)
+            {
+                if (ctx->inflight[i].used)
+                {
+                    dev->dev_cancel(ctx->inflight[i].handle);
+                }
+            }
+            cancelled = 1;
+        }
+        if (stop && _mbrm_shard_inflight(ctx) == 0)
+        {
+            break;
+        }
+
+        struct pollfd pfd[2] =
+        {
+            {.fd = loop->get_fd(&ctx->lb), .events = loop->get_events(&ctx->lb)},
+            {.fd = ctx->efd, .events = POLLIN},
+        };
+
+        poll(pfd, 2, loop->get_timeout(&ctx->lb, loop->get_time()));
+        if (pfd[1].revents & POLLIN)
+        {
+            _mbrm_shard_clear(ctx->efd);
+        }
+        loop->process(&ctx->lb, loop->get_time(), pfd[0].revents);
+        if (!stop)
+        {
+            _mbrm_shard_pull(ctx);
+        }
+    }
+
+    for (i = 0; i < ctx->bus.dev_num; i++)
+    {
+        dev->dev_detach(ctx->bus.devs[i].name);
+    }
+    dev->bus_select(NULL);
+    return NULL;
+}
+
+/**
+ * @brief Start one thread per bus, each runs its own protocol and device
+ *        state on a pinned CPU. Buses never share a lock.
+ * @param buses Copied, the devices are registered before the threads start.
+ * @param num
+ * @return 0 Succeed; -1: Parameter err, a device did not register; 2: Resource alloc fail.
+ */
+static int _mbrm_shard_start(const mbrm_shard_bus_t *buses, uint8_t num)
+{
+    mbrm_shard_ctx_t *ctx;
+    pthread_attr_t attr;
+    cpu_set_t set;
+    uint8_t i;
+    int ret;
+
+    mbrm_shard_priv = (mbrm_shard_private_t *)mbrm_shard.priv;
+    if (buses == NULL || num == 0 || num > MBRM_SHARD_MAX)
+    {
+        mbrm_log_e("shard_start: Parameter err.\r\n");
+        return -1;
+    }
+    memset(mbrm_shard_priv, 0, sizeof(mbrm_shard_private_t));
+    mbrm_shard_priv->done_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mbrm_shard_priv->done_efd < 0)
+    {
+        return 2;
+    }
+
+    for (i = 0; i < num; i++)
+    {
+        ctx = &mbrm_shard_priv->shards[i];
+        ctx->id = i;
+        ctx->bus = buses[i];
+        ctx->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        mbrm_shard_priv->num = i + 1;
+        if (ctx->efd < 0)
+        {
+            mbrm_log_e("shard_start: Resource alloc fail.\r\n");
+            mbrm_shard.stop();
+            return 2;
+        }
+        /* A device that does not register fails the start, not its requests later. */
+        ret = _mbrm_shard_setup(ctx);
+        if (ret != 0)
+        {
+            mbrm_shard.stop();
+            return (ret == 2) ? 2 : -1;
+        }
+
+        pthread_attr_init(&attr);
+        if (ctx->bus.cpu >= 0)
+        {
+            CPU_ZERO(&set);
+            CPU_SET(ctx->bus.cpu, &set);
+            if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0)
+            {
+                mbrm_log_w("Shard %d: pin to cpu %d fail.\r\n", i, ctx->bus.cpu);
+            }
+        }
+        ret = pthread_create(&ctx->thread, &attr, _mbrm_shard_run, ctx);
+        pthread_attr_destroy(&attr);
+        if (ret != 0)
+        {
+            mbrm_log_e("shard_start: Thread create fail.\r\n");
+            _mbrm_shard_detach(ctx, ctx->bus.dev_num);
+            mbrm_shard.stop();
+            return 2;
+        }
+        ctx->running = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stop the shards, requests still queued are dropped. Returns once
+ *        the requests on the buses are cancelled, at most one over_time.
+ * @param
+ */
+static void _mbrm_shard_stop(void)
+{
+    mbrm_shard_ctx_t *ctx;
+    uint8_t i;
+
+    if (mbrm_shard_priv == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < mbrm_shard_priv->num; i++)
+    {
+        ctx = &mbrm_shard_priv->shards[i];
+        if (ctx->running)
+        {
+            __atomic_store_n(&ctx->rings.stop, 1, __ATOMIC_RELEASE);
+            _mbrm_shard_signal(ctx->efd);
+            pthread_join(ctx->thread, NULL);
+            ctx->running = 0;
+        }
+        if (ctx->efd >= 0)
+        {
+            close(ctx->efd);
+        }
+    }
+    close(mbrm_shard_priv->done_efd);
+    mbrm_shard_priv->num = 0;
+}
+
+/**
+ * @brief dev_request on the shard owning the device. Call it from one
+ *        thread, the hand-off to the shard takes no lock.
+ * @param name
+ * @param cmd Below the cmd_num of the device.
+ * @param data Written with dev_set_data before the command is sent, NULL: None.
+ * @param len
+ * @param tag Returned in the completion.
+ * @return 0 Succeed; -1: Parameter err; 1: Target not found; 3: Ring is full.
+ */
+static int _mbrm_shard_send(const char *name, int cmd, const void *data, uint16_t len, uint32_t tag)
+{
+    mbrm_shard_ctx_t *ctx = NULL;
+    mbrm_shard_req_t *req;
+    uint32_t head;
+    uint8_t i, k;
+
+    if (mbrm_shard_priv == NULL || name == NULL || cmd < 0 || len > MBRM_SHARD_DATA_MAX || (len > 0 && data == NULL))
+    {
+        mbrm_log_e("shard_send: Parameter err.\r\n");
+        return -1;
+    }
+    for (i = 0; i < mbrm_shard_priv->num && ctx == NULL; i++)
+    {
+        for (k = 0; k < mbrm_shard_priv->shards[i].bus.dev_num; k++)
+        {
+            if (strncmp(mbrm_shard_priv->shards[i].bus.devs[k].name, name, MBRM_DEVICE_NAME_LENTH) == 0)
+            {
+                ctx = &mbrm_shard_priv->shards[i];
+                break;
+            }
+        }
+    }
+    if (ctx == NULL)
+    {
+        mbrm_log_w("shard_send: Target not found.\r\n");
+        return 1;
+    }
+    if (cmd >= ctx->bus.devs[k].cmd_num)
+    {
+        mbrm_log_e("shard_send: Parameter err.\r\n");
+        return -1;
+    }
+    if (ctx->sent - __atomic_load_n(&ctx->polled, __ATOMIC_ACQUIRE) >= MBRM_SHARD_RING_DEPTH)
+    {
+        return 3;
+    }
+
+    head = ctx->rings.req_ring.head;
+    req = &ctx->rings.req[head & (MBRM_SHARD_RING_DEPTH - 1)];
+    req->tag = tag;
+    strncpy(req->name, name, MBRM_DEVICE_NAME_LENTH);
+    req->cmd = (uint8_t)cmd;
+    req->len = len;
+    if (len > 0)
+    {
+        memcpy(req->data, data, len);
+    }
+    __atomic_store_n(&ctx->rings.req_ring.head, head + 1, __ATOMIC_RELEASE);
+    ctx->sent++;
+    _mbrm_shard_signal(ctx->efd);
+    return 0;
+}
+
+/**
+ * @brief Deliver the completions of every shard on the calling thread,
+ *        call it from one thread when get_fd is readable.
+ * @param cb
+ * @param arg
+ * @return Number of completions delivered.
+ */
+static int _mbrm_shard_poll(void (*cb)(const mbrm_shard_done_t *done, void *arg), void *arg)
+{
+    mbrm_shard_ctx_t *ctx;
+    uint32_t tail;
+    uint8_t i;
+    int n = 0;
+
+    if (mbrm_shard_priv == NULL || mbrm_shard_priv->num == 0)
+    {
+        return 0;
+    }
+    /* Cleared first, a completion queued meanwhile signals again. */
+    _mbrm_shard_clear(mbrm_shard_priv->done_efd);
+    for (i = 0; i < mbrm_shard_priv->num; i++)
+    {
+        ctx = &mbrm_shard_priv->shards[i];
+        tail = ctx->rings.done_ring.tail;
+        while (tail != __atomic_load_n(&ctx->rings.done_ring.head, __ATOMIC_ACQUIRE))
+        {
+            if (cb != NULL)
+            {
+                cb(&ctx->rings.done[tail & (MBRM_SHARD_RING_DEPTH - 1)], arg);
+            }
+            tail++;
+            n++;
+            __atomic_store_n(&ctx->rings.done_ring.tail, tail, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&ctx->polled, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief eventfd readable when completions wait for poll.
+ * @param
+ * @return
+ */
+static int _mbrm_shard_get_fd(void)
+{
+    return (mbrm_shard_priv == NULL || mbrm_shard_priv->num == 0) ? -1 : mbrm_shard_priv->done_efd;
+}
+
+static mbrm_shard_t mbrm_shard =
+{
+    .start = _mbrm_shard_start,
+    .stop = _mbrm_shard_stop,
+    .send = _mbrm_shard_send,
+    .poll = _mbrm_shard_poll,
+    .get_fd = _mbrm_shard_get_fd,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_shard_t *mbrm_get_shard(void)
+{
+    return &mbrm_shard;
+}
+
+#endif /* MBRM_SHARD_SWITCH */
@@ -0,0 +1,142 @@
+/*
+ * mbrm_shard.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_SHARD_H_
+#define _MODBUS_RTU_MASTER_MBRM_SHARD_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "mbrm_cfg.h"
+#include "mbrm_device.h"
+#include "mbrm_loop.h"
+
+typedef struct
+{
+    /* Serial port of the bus, driven by mbrm_loop in the shard. */
+    mbrm_loop_cfg_t loop;
+    /* CPU the shard is pinned to, -1: Not pinned. */
+    int cpu;
+    /* Devices on the bus, registered by start and used to route send, cmd_num must be set. */
+    mbrm_device_info_t *devs;
+    uint8_t dev_num;
+} mbrm_shard_bus_t;
+
+typedef struct
+{
+    uint32_t tag;
+    char name[MBRM_DEVICE_NAME_LENTH];
+    uint8_t cmd;
+    /* Bytes given to dev_set_data before the command is sent, 0: None. */
+    uint16_t len;
+    uint8_t data[MBRM_SHARD_DATA_MAX];
+} mbrm_shard_req_t;
+
+typedef struct
+{
+    uint32_t tag;
+    uint8_t shard;
+    /* 0: Sent on the bus; -1: Parameter err; 1: Target not found; 2: Memory alloc fail. */
+    int8_t ret;
+    mbrm_queue_status_t status;
+    /* Bytes of the command's data block after completion, truncated to MBRM_SHARD_DATA_MAX. */
+    uint16_t len;
+    uint8_t data[MBRM_SHARD_DATA_MAX];
+} mbrm_shard_done_t;
+
+/**
+ * Single producer single consumer indexes, each on its own cache line.
+ */
+typedef struct
+{
+    uint32_t head;
+    uint8_t reserved0[60];
+    uint32_t tail;
+    uint8_t reserved1[60];
+} mbrm_shard_ring_t;
+
+/**
+ * Shared with the shard thread.
+ */
+typedef struct
+{
+    mbrm_shard_ring_t req_ring;
+    mbrm_shard_req_t req[MBRM_SHARD_RING_DEPTH];
+    mbrm_shard_ring_t done_ring;
+    mbrm_shard_done_t done[MBRM_SHARD_RING_DEPTH];
+    uint8_t stop;
+} mbrm_shard_rings_t;
+
+typedef struct
+{
+    uint8_t used;
+    uint32_t tag;
+    /* Handle of the request, cancelled by stop. */
+    uint32_t handle;
+    mbrm_device_cmd_t *pcmd;
+    struct mbrm_shard_ctx *ctx;
+} mbrm_shard_inflight_t;
+
+typedef struct mbrm_shard_ctx
+{
+    uint8_t id;
+    uint8_t running;
+    pthread_t thread;
+    /* Wakes the shard when a request is queued. */
+    int efd;
+    /* Requests sent and completions polled, sent - polled is kept under the ring depth. */
+    uint32_t sent;
+    uint32_t polled;
+    mbrm_shard_rings_t rings;
+    mbrm_shard_bus_t bus;
+
+    /* Used by the shard thread only. */
+    mbrm_loop_bus_t lb;
+    mbrm_shard_inflight_t inflight[MBRM_COMMUNICATION_QUEUE_MAX_LENTH];
+} mbrm_shard_ctx_t;
+
+typedef struct
+{
+    uint8_t num;
+    /* Written by every shard when a completion is queued. */
+    int done_efd;
+    mbrm_shard_ctx_t shards[MBRM_SHARD_MAX];
+} mbrm_shard_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_shard_private_t)];
+
+    /* PUBLIC */
+    int (*start)(const mbrm_shard_bus_t *buses, uint8_t num);
+    void (*stop)(void);
+    int (*send)(const char *name, int cmd, const void *data, uint16_t len, uint32_t tag);
+    int (*poll)(void (*cb)(const mbrm_shard_done_t *done, void *arg), void *arg);
+    int (*get_fd)(void);
+} mbrm_shard_t;
+
+const mbrm_shard_t *mbrm_get_shard(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_SHARD_H_ */
@@ -0,0 +1,380 @@
+/*
+ * mbrm_shm.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+#endif
+#include "mbrm_shm.h"
+
+#if MBRM_SHM_SWITCH
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Give up after this many torn reads in a row. */
+#define MBRM_SHM_READ_RETRY 1000
+
+static mbrm_shm_t mbrm_shm;
+static mbrm_shm_private_t *mbrm_shm_priv;
+
+/**
+ * @brief
+ * @param map
+ * @return
+ */
+static mbrm_shm_slot_t *_mbrm_shm_slots(const mbrm_shm_map_t *map)
+{
+    return (mbrm_shm_slot_t *)(map->base + sizeof(mbrm_shm_header_t));
+}
+
+/**
+ * @brief Look up a slot by bus, device name and command index.
+ * @param map
+ * @param bus
+ * @param name
+ * @param cmd
+ * @return Slot index; -1: Not found target.
+ */
+static int _mbrm_shm_find(const mbrm_shm_map_t *map, uint16_t bus, const char *name, uint16_t cmd)
+{
+    const mbrm_shm_header_t *hdr;
+    const mbrm_shm_slot_t *slots;
+    uint16_t i, used;
+
+    if (map == NULL || map->base == NULL || name == NULL)
+    {
+        return -1;
+    }
+    hdr = (const mbrm_shm_header_t *)map->base;
+    slots = _mbrm_shm_slots(map);
+    used = __atomic_load_n(&hdr->slot_used, __ATOMIC_ACQUIRE);
+    if (sizeof(mbrm_shm_header_t) + (size_t)used * sizeof(mbrm_shm_slot_t) > map->size)
+    {
+        used = (map->size - sizeof(mbrm_shm_header_t)) / sizeof(mbrm_shm_slot_t);
+    }
+    for (i = 0; i < used; i++)
+    {
+        if (slots[i].cmd == cmd && slots[i].bus == bus && strncmp(slots[i].name, name, MBRM_SHM_NAME_LENTH) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Create the segment, an existing one with the same name is replaced.
+ * @param shm_name e.g. "/mbrm0"
+ * @param slot_max
+ * @param data_size Bytes shared by all slots.
+ * @param get_time_us Stamps each update, may be NULL.
+ * @return 0 Succeed; -1: Parameter err; 2: Create fail.
+ */
+static int _mbrm_shm_open(const char *shm_name, uint16_t slot_max, uint32_t data_size, uint32_t (*get_time_us)(void))
+{
+    mbrm_shm_header_t *hdr;
+    size_t size;
+    void *base;
+    int fd;
+
+    if (shm_name == NULL || slot_max == 0 || data_size == 0)
+    {
+        mbrm_log_e("shm_open: Parameter err.\r\n");
+        return -1;
+    }
+    mbrm_shm_priv = (mbrm_shm_private_t *)mbrm_shm.priv;
+    if (mbrm_shm_priv->map.base != NULL)
+    {
+        munmap(mbrm_shm_priv->map.base, mbrm_shm_priv->map.size);
+        mbrm_shm_priv->map.base = NULL;
+    }
+
+    size = sizeof(mbrm_shm_header_t) + slot_max * sizeof(mbrm_shm_slot_t) + data_size;
+    shm_unlink(shm_name);
+    fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        mbrm_log_e("shm_open: Create fail.\r\n");
+        return 2;
+    }
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        shm_unlink(shm_name);
+        mbrm_log_e("shm_open: Create fail.\r\n");
+        return 2;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        shm_unlink(shm_name);
+        mbrm_log_e("shm_open: Create fail.\r\n");
+        return 2;
+    }
+
+    hdr = (mbrm_shm_header_t *)base;
+    hdr->version = MBRM_SHM_VERSION;
+    hdr->slot_max = slot_max;
+    hdr->slot_used = 0;
+    hdr->data_offset = sizeof(mbrm_shm_header_t) + slot_max * sizeof(mbrm_shm_slot_t);
+    hdr->data_size = data_size;
+    hdr->data_used = 0;
+    /* Readers check the magic last. */
+    __atomic_store_n(&hdr->magic, MBRM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    mbrm_shm_priv->map.base = (uint8_t *)base;
+    mbrm_shm_priv->map.size = size;
+    mbrm_shm_priv->get_time_us = get_time_us;
+    return 0;
+}
+
+/**
+ * @brief Copy a decoded block into its slot, the slot is created on first
+ *        use. Bus threads publish concurrently, they take turns on a lock
+ *        held for the copy only.
+ * @param bus
+ * @param name
+ * @param cmd
+ * @param type
+ * @param num
+ * @param data
+ * @param len
+ * @return 0 Succeed; -1: Parameter err; 1: Segment not open; 2: Segment is full.
+ */
+static int _mbrm_shm_publish(uint16_t bus, const char *name, uint16_t cmd, uint16_t type, uint16_t num,
+                             const void *data, uint32_t len)
+{
+    mbrm_shm_header_t *hdr;
+    mbrm_shm_slot_t *slot;
+    int pos;
+
+    if (mbrm_shm_priv == NULL || mbrm_shm_priv->map.base == NULL)
+    {
+        return 1;
+    }
+    if (name == NULL || data == NULL)
+    {
+        return -1;
+    }
+    hdr = (mbrm_shm_header_t *)mbrm_shm_priv->map.base;
+
+    while (__atomic_test_and_set(&mbrm_shm_priv->lock, __ATOMIC_ACQUIRE))
+    {
+    }
+    pos = _mbrm_shm_find(&mbrm_shm_priv->map, bus, name, cmd);
+    if (pos < 0)
+    {
+        if (hdr->slot_used >= hdr->slot_max || hdr->data_size - hdr->data_used < len)
+        {
+            __atomic_clear(&mbrm_shm_priv->lock, __ATOMIC_RELEASE);
+            mbrm_log_w("shm_publish: Segment is full.\r\n");
+            return 2;
+        }
+        pos = hdr->slot_used;
+        slot = &_mbrm_shm_slots(&mbrm_shm_priv->map)[pos];
+        memset(slot, 0, sizeof(mbrm_shm_slot_t));
+        strncpy(slot->name, name, MBRM_SHM_NAME_LENTH - 1);
+        slot->cmd = cmd;
+        slot->type = type;
+        slot->num = num;
+        slot->bus = bus;
+        slot->data_offset = hdr->data_offset + hdr->data_used;
+        slot->data_len = len;
+        hdr->data_used += (len + 7) & ~7u;
+        __atomic_store_n(&hdr->slot_used, pos + 1, __ATOMIC_RELEASE);
+    }
+    slot = &_mbrm_shm_slots(&mbrm_shm_priv->map)[pos];
+    if (len > slot->data_len)
+    {
+        len = slot->data_len;
+    }
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(mbrm_shm_priv->map.base + slot->data_offset, data, len);
+    slot->time = (mbrm_shm_priv->get_time_us != NULL) ? mbrm_shm_priv->get_time_us() : 0;
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    __atomic_clear(&mbrm_shm_priv->lock, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief
+ * @param shm_name Unlinked as well when not NULL.
+ */
+static void _mbrm_shm_close(const char *shm_name)
+{
+    if (mbrm_shm_priv != NULL && mbrm_shm_priv->map.base != NULL)
+    {
+        munmap(mbrm_shm_priv->map.base, mbrm_shm_priv->map.size);
+        mbrm_shm_priv->map.base = NULL;
+    }
+    if (shm_name != NULL)
+    {
+        shm_unlink(shm_name);
+    }
+}
+
+/**
+ * @brief Map a segment read-only.
+ * @param shm_name
+ * @param map
+ * @return 0 Succeed; -1: Parameter err; 1: Not found target; 2: Bad layout.
+ */
+static int _mbrm_shm_attach(const char *shm_name, mbrm_shm_map_t *map)
+{
+    const mbrm_shm_header_t *hdr;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if (shm_name == NULL || map == NULL)
+    {
+        return -1;
+    }
+    fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(mbrm_shm_header_t))
+    {
+        close(fd);
+        return 2;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return 1;
+    }
+
+    hdr = (const mbrm_shm_header_t *)base;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != MBRM_SHM_MAGIC || hdr->version != MBRM_SHM_VERSION)
+    {
+        munmap(base, st.st_size);
+        return 2;
+    }
+    map->base = (uint8_t *)base;
+    map->size = st.st_size;
+    return 0;
+}
+
+/**
+ * @brief Take a torn-free snapshot of a slot without locking.
+ * @param map
+ * @param slot
+ * @param buf
+ * @param len
+ * @param time Update time of the snapshot, may be NULL.
+ * @return Bytes copied; -1: Parameter err; -2: Writer kept the slot busy.
+ */
+static int _mbrm_shm_read(const mbrm_shm_map_t *map, int slot, void *buf, uint32_t len, uint32_t *time)
+{
+    const mbrm_shm_header_t *hdr;
+    const mbrm_shm_slot_t *ps;
+    uint32_t seq, retry;
+
+    if (map == NULL || map->base == NULL || buf == NULL || slot < 0)
+    {
+        return -1;
+    }
+    hdr = (const mbrm_shm_header_t *)map->base;
+    if (slot >= __atomic_load_n(&hdr->slot_used, __ATOMIC_ACQUIRE) ||
+            sizeof(mbrm_shm_header_t) + (size_t)(slot + 1) * sizeof(mbrm_shm_slot_t) > map->size)
+    {
+        return -1;
+    }
+    ps = &_mbrm_shm_slots(map)[slot];
+    if (len > ps->data_len)
+    {
+        len = ps->data_len;
+    }
+    /* The segment comes from another process, never copy past the map. */
+    if ((size_t)ps->data_offset > map->size || len > map->size - ps->data_offset)
+    {
+        return -1;
+    }
+
+    for (retry = 0; retry < MBRM_SHM_READ_RETRY; retry++)
+    {
+        seq = __atomic_load_n(&ps->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+        memcpy(buf, map->base + ps->data_offset, len);
+        if (time != NULL)
+        {
+            *time = ps->time;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ps->seq, __ATOMIC_RELAXED) == seq)
+        {
+            return len;
+        }
+    }
+    return -2;
+}
+
+/**
+ * @brief
+ * @param map
+ */
+static void _mbrm_shm_detach(mbrm_shm_map_t *map)
+{
+    if (map != NULL && map->base != NULL)
+    {
+        munmap(map->base, map->size);
+        map->base = NULL;
+    }
+}
+
+static mbrm_shm_t mbrm_shm =
+{
+    .open = _mbrm_shm_open,
+    .publish = _mbrm_shm_publish,
+    .close = _mbrm_shm_close,
+    .attach = _mbrm_shm_attach,
+    .find = _mbrm_shm_find,
+    .read = _mbrm_shm_read,
+    .detach = _mbrm_shm_detach,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_shm_t *mbrm_get_shm(void)
+{
+    return &mbrm_shm;
+}
+
+#endif /* MBRM_SHM_SWITCH */
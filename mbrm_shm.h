@@ -0,0 +1,103 @@
+/*
+ * mbrm_shm.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_SHM_H_
+#define _MODBUS_RTU_MASTER_MBRM_SHM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mbrm_cfg.h"
+
+#define MBRM_SHM_MAGIC 0x5352424D   /* "MBRS" */
+#define MBRM_SHM_VERSION 2
+#define MBRM_SHM_NAME_LENTH 16
+
+/**
+ * Segment layout: mbrm_shm_header_t, slot_max x mbrm_shm_slot_t, then the
+ * data area. Every slot owns data_len bytes at data_offset from the segment
+ * start. seq is odd while the writer updates the slot. A slot is keyed by
+ * bus, device name and command, names may repeat on other buses.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slot_max;
+    uint16_t slot_used;
+    uint16_t reserved;
+    uint32_t data_offset;
+    uint32_t data_size;
+    uint32_t data_used;
+} mbrm_shm_header_t;
+
+typedef struct
+{
+    char name[MBRM_SHM_NAME_LENTH];
+    uint16_t cmd;
+    uint16_t type;
+    uint16_t num;
+    uint16_t bus;
+    uint32_t data_offset;
+    uint32_t data_len;
+    uint32_t seq;
+    uint32_t time;
+} mbrm_shm_slot_t;
+
+typedef struct
+{
+    uint8_t *base;
+    size_t size;
+} mbrm_shm_map_t;
+
+typedef struct
+{
+    mbrm_shm_map_t map;
+    uint32_t (*get_time_us)(void);
+    /* Taken by publish, every bus thread writes the segment. */
+    uint8_t lock;
+} mbrm_shm_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_shm_private_t)];
+
+    /* PUBLIC */
+    /* Writer side */
+    int (*open)(const char *shm_name, uint16_t slot_max, uint32_t data_size, uint32_t (*get_time_us)(void));
+    int (*publish)(uint16_t bus, const char *name, uint16_t cmd, uint16_t type, uint16_t num, const void *data,
+                   uint32_t len);
+    void (*close)(const char *shm_name);
+
+    /* Reader side, any process */
+    int (*attach)(const char *shm_name, mbrm_shm_map_t *map);
+    int (*find)(const mbrm_shm_map_t *map, uint16_t bus, const char *name, uint16_t cmd);
+    int (*read)(const mbrm_shm_map_t *map, int slot, void *buf, uint32_t len, uint32_t *time);
+    void (*detach)(mbrm_shm_map_t *map);
+} mbrm_shm_t;
+
+const mbrm_shm_t *mbrm_get_shm(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_SHM_H_ */
@@ -0,0 +1,497 @@
+/*
+ * mbrm_sim.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_sim.h"
+
+static mbrm_sim_t mbrm_sim;
+static mbrm_sim_private_t *mbrm_sim_priv;
+
+/**
+ * @brief Time to shift len characters out at the configured baud.
+ * @param len
+ * @return uint32_t us
+ */
+static uint32_t _mbrm_sim_frame_time_us(uint16_t len)
+{
+    uint64_t bits = (uint64_t)len * mbrm_sim_priv->cfg.char_bits * 1000000;
+    return (uint32_t)((bits + mbrm_sim_priv->cfg.baud - 1) / mbrm_sim_priv->cfg.baud);
+}
+
+/**
+ * @brief
+ * @param rsp
+ * @param len
+ * @return uint16_t Length with CRC appended.
+ */
+static uint16_t _mbrm_sim_append_crc(uint8_t *rsp, uint16_t len)
+{
+    uint16_t crc = mbrm_sim_priv->protocol->get_crc(rsp, len);
+    rsp[len] = crc & 0xff;
+    rsp[len + 1] = crc >> 8;
+    return len + 2;
+}
+
+/**
+ * @brief Built-in register bank slave.
+ * @param req
+ * @param len
+ * @param rsp
+ * @param delay_us
+ * @return uint16_t Response length, 0 means no answer.
+ */
+static uint16_t _mbrm_sim_regbank(const uint8_t *req, uint16_t len, uint8_t *rsp, uint32_t *delay_us)
+{
+    uint16_t reg_addr, num, i;
+    (void)delay_us;
+
+    if (len < 8 || mbrm_sim_priv->protocol->get_crc(req, len - 2) != (req[len - 1] << 8 | req[len - 2]))
+    {
+        return 0;
+    }
+    if (req[0] == 0 || (mbrm_sim_priv->cfg.slave_addr != 0 && req[0] != mbrm_sim_priv->cfg.slave_addr))
+    {
+        return 0;
+    }
+
+    reg_addr = req[2] << 8 | req[3];
+    num = req[4] << 8 | req[5];
+    rsp[0] = req[0];
+    rsp[1] = req[1];
+    switch (req[1])
+    {
+    case 0x03:
+        if (num == 0 || num > 125 || reg_addr + num > mbrm_sim_priv->cfg.reg_num)
+        {
+            break;
+        }
+        rsp[2] = num * 2;
+        for (i = 0; i < num; i++)
+        {
+            rsp[3 + i * 2] = mbrm_sim_priv->cfg.regs[reg_addr + i] >> 8;
+            rsp[4 + i * 2] = mbrm_sim_priv->cfg.regs[reg_addr + i] & 0xff;
+        }
+        return _mbrm_sim_append_crc(rsp, 3 + num * 2);
+
+    case 0x06:
+        if (reg_addr >= mbrm_sim_priv->cfg.reg_num)
+        {
+            break;
+        }
+        mbrm_sim_priv->cfg.regs[reg_addr] = num;
+        memcpy(rsp, req, 8);
+        return 8;
+
+    case 0x10:
+        if (num == 0 || num > 123 || reg_addr + num > mbrm_sim_priv->cfg.reg_num || len != 9 + num * 2)
+        {
+            break;
+        }
+        for (i = 0; i < num; i++)
+        {
+            mbrm_sim_priv->cfg.regs[reg_addr + i] = req[7 + i * 2] << 8 | req[8 + i * 2];
+        }
+        memcpy(rsp, req, 6);
+        return _mbrm_sim_append_crc(rsp, 6);
+
+    default:
+        rsp[1] = req[1] | 0x80;
+        rsp[2] = 0x01;
+        return _mbrm_sim_append_crc(rsp, 3);
+    }
+
+    /* Illegal data address. */
+    rsp[1] = req[1] | 0x80;
+    rsp[2] = 0x02;
+    return _mbrm_sim_append_crc(rsp, 3);
+}
+
+/**
+ * @brief xorshift32.
+ * @param
+ * @return
+ */
+static uint32_t _mbrm_sim_rand(void)
+{
+    uint32_t x = mbrm_sim_priv->rng;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    mbrm_sim_priv->rng = x;
+    return x;
+}
+
+/**
+ * @brief
+ * @param ppm
+ * @return 1: The fault happens.
+ */
+static uint8_t _mbrm_sim_chance(uint32_t ppm)
+{
+    return (ppm != 0 && _mbrm_sim_rand() % 1000000 < ppm);
+}
+
+/**
+ * @brief Flip bits of a frame on the line.
+ * @param buf
+ * @param len
+ */
+static void _mbrm_sim_noise(uint8_t *buf, uint16_t len)
+{
+    uint8_t hit = 0;
+    uint16_t i;
+    uint8_t k;
+
+    if (mbrm_sim_priv->cfg.fault.bit_error_ppm == 0)
+    {
+        return;
+    }
+    for (i = 0; i < len; i++)
+    {
+        for (k = 0; k < 8; k++)
+        {
+            if (_mbrm_sim_chance(mbrm_sim_priv->cfg.fault.bit_error_ppm))
+            {
+                buf[i] ^= 1 << k;
+                hit = 1;
+            }
+        }
+    }
+    mbrm_sim_priv->stat.corrupted += hit;
+}
+
+/**
+ * @brief Extra turnaround of a slave.
+ * @param slave_addr
+ * @return uint32_t us
+ */
+static uint32_t _mbrm_sim_latency(uint8_t slave_addr)
+{
+    const mbrm_sim_latency_t *lat = &mbrm_sim_priv->cfg.fault.latency;
+    uint32_t us = 0;
+
+    if (mbrm_sim_priv->cfg.fault.latency_cb != NULL)
+    {
+        lat = mbrm_sim_priv->cfg.fault.latency_cb(slave_addr);
+        if (lat == NULL)
+        {
+            return 0;
+        }
+    }
+    if (lat->jitter_us != 0)
+    {
+        us += _mbrm_sim_rand() % (lat->jitter_us + 1);
+    }
+    if (_mbrm_sim_chance(lat->tail_ppm))
+    {
+        us += lat->tail_us;
+    }
+    return us;
+}
+
+/**
+ * @brief write_cb of the simulated bus, schedules the slave answer.
+ * @param data
+ * @param len
+ */
+static void _mbrm_sim_write(const uint8_t *data, uint16_t len)
+{
+    const mbrm_sim_fault_t *fault = &mbrm_sim_priv->cfg.fault;
+    mbrm_sim_frame_t *frame;
+    uint32_t delay_us = mbrm_sim_priv->cfg.turnaround_us;
+    uint32_t gap_us = mbrm_sim_priv->protocol->gap_us(mbrm_sim_priv->cfg.baud, mbrm_sim_priv->cfg.char_bits);
+    uint8_t req[256];
+    uint64_t start;
+
+    mbrm_sim_priv->stat.tx_frames++;
+    start = (mbrm_sim_priv->bus_free > mbrm_sim_priv->now) ? mbrm_sim_priv->bus_free : mbrm_sim_priv->now;
+    mbrm_sim_priv->bus_free = start + _mbrm_sim_frame_time_us(len) + gap_us;
+
+    if (mbrm_sim_priv->pending_num >= MBRM_SIM_PENDING_MAX)
+    {
+        mbrm_sim_priv->stat.dropped++;
+        return;
+    }
+    if (_mbrm_sim_chance(fault->drop_ppm))
+    {
+        mbrm_sim_priv->stat.lost++;
+        return;
+    }
+    len = (len > sizeof(req)) ? sizeof(req) : len;
+    memcpy(req, data, len);
+    _mbrm_sim_noise(req, len);
+
+    frame = &mbrm_sim_priv->pending[mbrm_sim_priv->pending_num];
+    if (mbrm_sim_priv->cfg.slave_cb != NULL)
+    {
+        frame->len = mbrm_sim_priv->cfg.slave_cb(req, len, frame->buf, &delay_us);
+    }
+    else
+    {
+        frame->len = _mbrm_sim_regbank(req, len, frame->buf, &delay_us);
+    }
+    if (frame->len == 0)
+    {
+        return;
+    }
+    delay_us += _mbrm_sim_latency(req[0]);
+    _mbrm_sim_noise(frame->buf, frame->len);
+    if (frame->len > 1 && _mbrm_sim_chance(fault->truncate_ppm))
+    {
+        frame->len = 1 + _mbrm_sim_rand() % (frame->len - 1);
+        mbrm_sim_priv->stat.truncated++;
+    }
+
+    /* The master sees the frame once 3.5 characters of silence follow it. */
+    frame->time = mbrm_sim_priv->bus_free + delay_us + _mbrm_sim_frame_time_us(frame->len) + gap_us;
+    if (_mbrm_sim_chance(fault->late_ppm))
+    {
+        frame->time += fault->late_us;
+        mbrm_sim_priv->stat.late++;
+    }
+    mbrm_sim_priv->bus_free = frame->time;
+    mbrm_sim_priv->pending_num++;
+
+    if (_mbrm_sim_chance(fault->duplicate_ppm) && mbrm_sim_priv->pending_num < MBRM_SIM_PENDING_MAX)
+    {
+        mbrm_sim_priv->pending[mbrm_sim_priv->pending_num] = *frame;
+        frame = &mbrm_sim_priv->pending[mbrm_sim_priv->pending_num++];
+        frame->time += _mbrm_sim_frame_time_us(frame->len) + gap_us;
+        mbrm_sim_priv->bus_free = frame->time;
+        mbrm_sim_priv->stat.duplicated++;
+    }
+}
+
+/**
+ * @brief
+ * @param over_time ms
+ */
+static void _mbrm_sim_timer_start(uint16_t over_time)
+{
+    mbrm_sim_priv->timer_on = 1;
+    mbrm_sim_priv->timer_deadline = mbrm_sim_priv->now + (uint64_t)over_time * 1000;
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_sim_timer_stop(void)
+{
+    mbrm_sim_priv->timer_on = 0;
+}
+
+/**
+ * @brief
+ * @param
+ * @return uint64_t Virtual time in us.
+ */
+static uint64_t _mbrm_sim_get_time(void)
+{
+    return mbrm_sim_priv->now;
+}
+
+/**
+ * @brief
+ * @param
+ * @return uint32_t Virtual time in us, wraps like a hardware counter.
+ */
+static uint32_t _mbrm_sim_get_time_us(void)
+{
+    return (uint32_t)mbrm_sim_priv->now;
+}
+
+/**
+ * @brief Find the next event.
+ * @param time
+ * @return -1: Idle; 0 ~ MBRM_SIM_PENDING_MAX - 1: Response; MBRM_SIM_PENDING_MAX: Timer.
+ */
+static int _mbrm_sim_next(uint64_t *time)
+{
+    int next = -1;
+    uint8_t i;
+
+    for (i = 0; i < mbrm_sim_priv->pending_num; i++)
+    {
+        if (next < 0 || mbrm_sim_priv->pending[i].time < *time)
+        {
+            next = i;
+            *time = mbrm_sim_priv->pending[i].time;
+        }
+    }
+    /* A response completing together with the timer wins. */
+    if (mbrm_sim_priv->timer_on && (next < 0 || mbrm_sim_priv->timer_deadline < *time))
+    {
+        next = MBRM_SIM_PENDING_MAX;
+        *time = mbrm_sim_priv->timer_deadline;
+    }
+    return next;
+}
+
+/**
+ * @brief Advance virtual time to the next event and deliver it.
+ * @param
+ * @return 0 Event delivered; 1: Idle.
+ */
+static int _mbrm_sim_step(void)
+{
+    mbrm_sim_frame_t frame;
+    uint64_t time = 0;
+    int next = _mbrm_sim_next(&time);
+
+    if (next < 0)
+    {
+        return 1;
+    }
+    if (time > mbrm_sim_priv->now)
+    {
+        mbrm_sim_priv->now = time;
+    }
+
+    if (next == MBRM_SIM_PENDING_MAX)
+    {
+        mbrm_sim_priv->timer_on = 0;
+        mbrm_sim_priv->stat.timer_over++;
+        mbrm_sim_priv->protocol->timer_over();
+        return 0;
+    }
+
+    frame = mbrm_sim_priv->pending[next];
+    mbrm_sim_priv->pending_num--;
+    memmove(&mbrm_sim_priv->pending[next], &mbrm_sim_priv->pending[next + 1],
+            (mbrm_sim_priv->pending_num - next) * sizeof(mbrm_sim_frame_t));
+    mbrm_sim_priv->stat.rx_frames++;
+    mbrm_sim_priv->protocol->receive(frame.buf, frame.len);
+    return 0;
+}
+
+/**
+ * @brief Deliver every event due up to time, then move the clock there.
+ * @param time
+ * @return uint32_t Number of events delivered.
+ */
+static uint32_t _mbrm_sim_run_until(uint64_t time)
+{
+    uint64_t next_time = 0;
+    uint32_t num = 0;
+
+    while (_mbrm_sim_next(&next_time) >= 0 && next_time <= time)
+    {
+        _mbrm_sim_step();
+        num++;
+    }
+    if (time > mbrm_sim_priv->now)
+    {
+        mbrm_sim_priv->now = time;
+    }
+    return num;
+}
+
+/**
+ * @brief Deliver events until the bus is idle or the clock passes limit.
+ * @param limit
+ * @return uint32_t Number of events delivered.
+ */
+static uint32_t _mbrm_sim_run_idle(uint64_t limit)
+{
+    uint32_t num = 0;
+
+    while (mbrm_sim_priv->now <= limit && _mbrm_sim_step() == 0)
+    {
+        num++;
+    }
+    return num;
+}
+
+/**
+ * @brief
+ * @param stat
+ */
+static void _mbrm_sim_get_stat(mbrm_sim_stat_t *stat)
+{
+    if (stat != NULL)
+    {
+        *stat = mbrm_sim_priv->stat;
+    }
+}
+
+/**
+ * @brief Reset the simulated bus and plug it into init_cfg.
+ * @param cfg
+ * @param init_cfg write_cb, timer and clock callbacks are overwritten.
+ */
+static void _mbrm_sim_init(const mbrm_sim_cfg_t *cfg, mbrm_init_cfg *init_cfg)
+{
+    mbrm_sim_priv = (mbrm_sim_private_t *)mbrm_sim.priv;
+    memset(mbrm_sim_priv, 0, sizeof(mbrm_sim_private_t));
+    mbrm_sim_priv->protocol = mbrm_get_protocol();
+
+    if (cfg == NULL)
+    {
+        mbrm_log_e("sim_init: parameter is NULL!\r\n");
+        return;
+    }
+    mbrm_sim_priv->cfg = *cfg;
+    if (mbrm_sim_priv->cfg.baud == 0)
+    {
+        mbrm_sim_priv->cfg.baud = 9600;
+    }
+    if (mbrm_sim_priv->cfg.char_bits == 0)
+    {
+        mbrm_sim_priv->cfg.char_bits = 11;
+    }
+    mbrm_sim_priv->rng = (cfg->fault.seed != 0) ? cfg->fault.seed : 1;
+
+    if (init_cfg != NULL)
+    {
+        init_cfg->write_cb = _mbrm_sim_write;
+        init_cfg->timer_start_cb = _mbrm_sim_timer_start;
+        init_cfg->timer_stop_cb = _mbrm_sim_timer_stop;
+        init_cfg->get_time_us = _mbrm_sim_get_time_us;
+    }
+}
+
+static mbrm_sim_t mbrm_sim =
+{
+    .init = _mbrm_sim_init,
+    .get_time_us = _mbrm_sim_get_time_us,
+    .get_time = _mbrm_sim_get_time,
+    .frame_time_us = _mbrm_sim_frame_time_us,
+    .step = _mbrm_sim_step,
+    .run_until = _mbrm_sim_run_until,
+    .run_idle = _mbrm_sim_run_idle,
+    .get_stat = _mbrm_sim_get_stat,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_sim_t *mbrm_get_sim(void)
+{
+    return &mbrm_sim;
+}
@@ -0,0 +1,147 @@
+/*
+ * mbrm_sim.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_SIM_H_
+#define _MODBUS_RTU_MASTER_MBRM_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+
+/**
+ * Maximum number of responses in flight on the simulated bus.
+ */
+#define MBRM_SIM_PENDING_MAX 4
+
+typedef struct
+{
+    /* Extra slave turnaround, uniform in 0 ~ jitter_us. */
+    uint32_t jitter_us;
+    /* Slow answers, tail_us more with a chance of tail_ppm. */
+    uint32_t tail_ppm;
+    uint32_t tail_us;
+} mbrm_sim_latency_t;
+
+/**
+ * Faults of a degraded line, all zero means a clean bus. Chances are in
+ * parts per million and drawn from a RNG seeded with seed, so a run
+ * repeats exactly.
+ */
+typedef struct
+{
+    uint32_t seed;
+    /* Each bit of requests and answers flips with this chance. */
+    uint32_t bit_error_ppm;
+    /* Request lost, the slave never answers. */
+    uint32_t drop_ppm;
+    /* Answer cut at a random length. */
+    uint32_t truncate_ppm;
+    /* Answer received twice. */
+    uint32_t duplicate_ppm;
+    /* Answer received late_us later than it should. */
+    uint32_t late_ppm;
+    uint32_t late_us;
+    mbrm_sim_latency_t latency;
+    /* Per-slave latency replacing latency, NULL: Same for all slaves. */
+    const mbrm_sim_latency_t *(*latency_cb)(uint8_t slave_addr);
+} mbrm_sim_fault_t;
+
+typedef struct
+{
+    uint32_t baud;
+    /* Bits per character including start, parity and stop bits(def: 11). */
+    uint8_t char_bits;
+    /* Slave turnaround time of the built-in register bank, in us. */
+    uint32_t turnaround_us;
+
+    /* Built-in register bank, used when slave_cb is NULL. 0 answers every address. */
+    uint8_t slave_addr;
+    uint16_t *regs;
+    uint16_t reg_num;
+
+    /**
+     * Custom slave model. Fills rsp and returns its length, 0 means no answer.
+     * delay_us is preset to turnaround_us and may be changed per frame.
+     */
+    uint16_t (*slave_cb)(const uint8_t *req, uint16_t len, uint8_t *rsp, uint32_t *delay_us);
+
+    mbrm_sim_fault_t fault;
+} mbrm_sim_cfg_t;
+
+typedef struct
+{
+    uint32_t tx_frames;
+    uint32_t rx_frames;
+    uint32_t timer_over;
+    uint32_t dropped;
+    /* Faults injected. */
+    uint32_t corrupted;
+    uint32_t lost;
+    uint32_t truncated;
+    uint32_t duplicated;
+    uint32_t late;
+} mbrm_sim_stat_t;
+
+typedef struct
+{
+    uint64_t time;
+    uint16_t len;
+    uint8_t buf[256];
+} mbrm_sim_frame_t;
+
+typedef struct
+{
+    uint64_t now;
+    uint64_t bus_free;
+    uint8_t timer_on;
+    uint64_t timer_deadline;
+    uint32_t rng;
+    uint8_t pending_num;
+    mbrm_sim_frame_t pending[MBRM_SIM_PENDING_MAX];
+    mbrm_sim_cfg_t cfg;
+    mbrm_sim_stat_t stat;
+    const mbrm_protocol_t *protocol;
+} mbrm_sim_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_sim_private_t)];
+
+    /* PUBLIC */
+    void (*init)(const mbrm_sim_cfg_t *cfg, mbrm_init_cfg *init_cfg);
+    uint32_t (*get_time_us)(void);
+    uint64_t (*get_time)(void);
+    uint32_t (*frame_time_us)(uint16_t len);
+    int (*step)(void);
+    uint32_t (*run_until)(uint64_t time);
+    uint32_t (*run_idle)(uint64_t limit);
+    void (*get_stat)(mbrm_sim_stat_t *stat);
+} mbrm_sim_t;
+
+const mbrm_sim_t *mbrm_get_sim(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_SIM_H_ */
@@ -0,0 +1,156 @@
+/*
+ * mbrm_sniff.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_sniff.h"
+
+static mbrm_sniff_t mbrm_sniff;
+static mbrm_sniff_private_t *mbrm_sniff_priv;
+
+/**
+ * @brief Listen to a bus driven by another master. Devices registered with
+ *        cmd_num are updated from its 0x03 traffic, nothing is sent.
+ * @param complete_cb Called for each command updated and not filtered out.
+ */
+static void _mbrm_sniff_start(void (*complete_cb)(mbrm_device_info_t *info, int cmd, void *data))
+{
+    mbrm_sniff_priv = (mbrm_sniff_private_t *)mbrm_sniff.priv;
+    memset(mbrm_sniff_priv, 0, sizeof(mbrm_sniff_private_t));
+    mbrm_sniff_priv->protocol = mbrm_get_protocol();
+    mbrm_sniff_priv->dev = get_mbrm_devive_obj();
+    mbrm_sniff_priv->complete_cb = complete_cb;
+    mbrm_sniff_priv->running = 1;
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_sniff_stop(void)
+{
+    if (mbrm_sniff_priv != NULL)
+    {
+        mbrm_sniff_priv->running = 0;
+    }
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_sniff_drop(void)
+{
+    if (mbrm_sniff_priv->pending)
+    {
+        mbrm_sniff_priv->pending = 0;
+        mbrm_sniff_priv->stat.unmatched++;
+    }
+}
+
+/**
+ * @brief Frames are split by the 3.5 char gap like for protocol receive.
+ *        A request is remembered until the next frame, which is its answer
+ *        when it comes from the same slave with the expected byte count.
+ * @param data
+ * @param len
+ */
+static void _mbrm_sniff_receive(const uint8_t *data, uint16_t len)
+{
+    if (mbrm_sniff_priv == NULL || !mbrm_sniff_priv->running)
+    {
+        return;
+    }
+    mbrm_sniff_priv->stat.frames++;
+
+    if (mbrm_sniff_priv->protocol->check_frame(data, len) != 0)
+    {
+        mbrm_sniff_priv->stat.crc_errors++;
+        _mbrm_sniff_drop();
+        return;
+    }
+
+    /* An answer of 0x03 has an odd length, a request is always 8 bytes. */
+    if (data[1] == 0x03 && len == 8)
+    {
+        _mbrm_sniff_drop();
+        mbrm_sniff_priv->stat.requests++;
+        mbrm_sniff_priv->pending = 1;
+        mbrm_sniff_priv->slave_addr = data[0];
+        mbrm_sniff_priv->register_addr = data[2] << 8 | data[3];
+        mbrm_sniff_priv->num = data[4] << 8 | data[5];
+        return;
+    }
+    if (!mbrm_sniff_priv->pending || data[0] != mbrm_sniff_priv->slave_addr)
+    {
+        _mbrm_sniff_drop();
+        return;
+    }
+
+    if (data[1] == 0x03 && data[2] == mbrm_sniff_priv->num * 2 && len == 5 + data[2])
+    {
+        mbrm_sniff_priv->pending = 0;
+        mbrm_sniff_priv->stat.pairs++;
+        mbrm_sniff_priv->dev->dev_feed(mbrm_sniff_priv->slave_addr, mbrm_sniff_priv->register_addr,
+                                       data + 3, mbrm_sniff_priv->num, mbrm_sniff_priv->complete_cb);
+        return;
+    }
+    if (data[1] == (0x03 | 0x80))
+    {
+        mbrm_sniff_priv->pending = 0;
+        mbrm_sniff_priv->stat.exceptions++;
+        return;
+    }
+    _mbrm_sniff_drop();
+}
+
+/**
+ * @brief
+ * @param stat
+ */
+static void _mbrm_sniff_get_stat(mbrm_sniff_stat_t *stat)
+{
+    if (stat != NULL && mbrm_sniff_priv != NULL)
+    {
+        *stat = mbrm_sniff_priv->stat;
+    }
+}
+
+static mbrm_sniff_t mbrm_sniff =
+{
+    .start = _mbrm_sniff_start,
+    .stop = _mbrm_sniff_stop,
+    .receive = _mbrm_sniff_receive,
+    .get_stat = _mbrm_sniff_get_stat,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_sniff_t *mbrm_get_sniff(void)
+{
+    return &mbrm_sniff;
+}
@@ -0,0 +1,72 @@
+/*
+ * mbrm_sniff.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_SNIFF_H_
+#define _MODBUS_RTU_MASTER_MBRM_SNIFF_H_
+
+#include "mbrm_cfg.h"
+#include "mbrm_protocol.h"
+#include "mbrm_device.h"
+
+typedef struct
+{
+    uint32_t frames;
+    uint32_t crc_errors;
+    uint32_t requests;
+    /* Requests answered and fed to the devices. */
+    uint32_t pairs;
+    uint32_t exceptions;
+    /* Requests left without a usable answer. */
+    uint32_t unmatched;
+} mbrm_sniff_stat_t;
+
+typedef struct
+{
+    uint8_t running;
+    uint8_t pending;
+    uint8_t slave_addr;
+    uint16_t register_addr;
+    uint16_t num;
+    mbrm_sniff_stat_t stat;
+    void (*complete_cb)(mbrm_device_info_t *info, int cmd, void *data);
+    const mbrm_protocol_t *protocol;
+    const mbrm_device_class_t *dev;
+} mbrm_sniff_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_sniff_private_t)];
+
+    /* PUBLIC */
+    void (*start)(void (*complete_cb)(mbrm_device_info_t *info, int cmd, void *data));
+    void (*stop)(void);
+    void (*receive)(const uint8_t *data, uint16_t len);
+    void (*get_stat)(mbrm_sniff_stat_t *stat);
+} mbrm_sniff_t;
+
+const mbrm_sniff_t *mbrm_get_sniff(void);
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_SNIFF_H_ */
@@ -0,0 +1,226 @@
+/*
+ * mbrm_trace.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "mbrm_trace.h"
+
+#if MBRM_TRACE_SWITCH
+
+#if (MBRM_TRACE_DEPTH & (MBRM_TRACE_DEPTH - 1)) != 0
+    #error "MBRM_TRACE_DEPTH must be a power of 2"
+#endif
+
+static mbrm_trace_t mbrm_trace;
+static mbrm_trace_private_t *mbrm_trace_priv;
+
+/**
+ * @brief Copy out one event, fails if a writer is reusing the slot.
+ * @param pos
+ * @param ev
+ * @return 0 Succeed; 1: Slot is being rewritten.
+ */
+static int _mbrm_trace_fetch(uint32_t pos, mbrm_trace_event_t *ev)
+{
+    mbrm_trace_event_t *slot = &mbrm_trace_priv->ring[pos & (MBRM_TRACE_DEPTH - 1)];
+    uint32_t seq;
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != pos + 1)
+    {
+        return 1;
+    }
+    memcpy(ev, slot, sizeof(mbrm_trace_event_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Record one event, safe to call from any context.
+ * @param type
+ * @param arg
+ * @param data
+ * @param len
+ */
+static void _mbrm_trace_record(mbrm_trace_type_t type, uint8_t arg, const uint8_t *data, uint16_t len)
+{
+    uint32_t pos;
+    uint16_t snap;
+    mbrm_trace_event_t *slot;
+
+    if (mbrm_trace_priv == NULL)
+    {
+        return;
+    }
+    pos = __atomic_fetch_add(&mbrm_trace_priv->head, 1, __ATOMIC_RELAXED);
+    slot = &mbrm_trace_priv->ring[pos & (MBRM_TRACE_DEPTH - 1)];
+
+    /* Invalidate the slot before rewriting it. */
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->time = (mbrm_trace_priv->get_time_us != NULL) ? mbrm_trace_priv->get_time_us() : 0;
+    slot->type = type;
+    slot->arg = arg;
+    slot->len = len;
+    snap = (len > MBRM_TRACE_SNAP_LENTH) ? MBRM_TRACE_SNAP_LENTH : len;
+    if (data != NULL && snap > 0)
+    {
+        memcpy(slot->data, data, snap);
+    }
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copy the retained events, oldest first.
+ * @param events
+ * @param max
+ * @return Number of events copied.
+ */
+static uint32_t _mbrm_trace_read(mbrm_trace_event_t *events, uint32_t max)
+{
+    uint32_t head, pos, num = 0;
+
+    if (mbrm_trace_priv == NULL || events == NULL)
+    {
+        return 0;
+    }
+    head = __atomic_load_n(&mbrm_trace_priv->head, __ATOMIC_ACQUIRE);
+    pos = (head > MBRM_TRACE_DEPTH) ? head - MBRM_TRACE_DEPTH : 0;
+    for (; pos != head && num < max; pos++)
+    {
+        if (_mbrm_trace_fetch(pos, &events[num]) == 0)
+        {
+            num++;
+        }
+    }
+    return num;
+}
+
+/**
+ * @brief Write TX/RX frames as a pcap stream.
+ * @param out
+ * @return 0 Succeed; -1: Parameter err.
+ */
+static int _mbrm_trace_dump_pcap(void (*out)(const void *, size_t))
+{
+    uint32_t head, pos;
+    mbrm_trace_event_t ev;
+    uint32_t rec_hdr[4];
+    const struct
+    {
+        uint32_t magic;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t thiszone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t network;
+    } file_hdr =
+    {
+        0xa1b2c3d4, 2, 4, 0, 0, MBRM_TRACE_SNAP_LENTH, MBRM_TRACE_PCAP_LINKTYPE
+    };
+
+    if (mbrm_trace_priv == NULL || out == NULL)
+    {
+        mbrm_log_e("trace_dump_pcap: Parameter err.\r\n");
+        return -1;
+    }
+
+    out(&file_hdr, sizeof(file_hdr));
+
+    head = __atomic_load_n(&mbrm_trace_priv->head, __ATOMIC_ACQUIRE);
+    pos = (head > MBRM_TRACE_DEPTH) ? head - MBRM_TRACE_DEPTH : 0;
+    for (; pos != head; pos++)
+    {
+        if (_mbrm_trace_fetch(pos, &ev) != 0)
+        {
+            continue;
+        }
+        if (ev.type != MBRM_TRACE_TX && ev.type != MBRM_TRACE_RX)
+        {
+            continue;
+        }
+        rec_hdr[0] = ev.time / 1000000;
+        rec_hdr[1] = ev.time % 1000000;
+        rec_hdr[2] = (ev.len > MBRM_TRACE_SNAP_LENTH) ? MBRM_TRACE_SNAP_LENTH : ev.len;
+        rec_hdr[3] = ev.len;
+        out(rec_hdr, sizeof(rec_hdr));
+        out(ev.data, rec_hdr[2]);
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ * @param
+ */
+static void _mbrm_trace_clear(void)
+{
+    if (mbrm_trace_priv == NULL)
+    {
+        return;
+    }
+    memset(mbrm_trace_priv->ring, 0, sizeof(mbrm_trace_priv->ring));
+    __atomic_store_n(&mbrm_trace_priv->head, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief
+ * @param get_time_us Monotonic microsecond clock, NULL records zero timestamps.
+ */
+static void _mbrm_trace_init(uint32_t (*get_time_us)(void))
+{
+    mbrm_trace_private_t *priv = (mbrm_trace_private_t *)mbrm_trace.priv;
+
+    memset(priv, 0, sizeof(mbrm_trace_private_t));
+    priv->get_time_us = get_time_us;
+    __atomic_store_n(&mbrm_trace_priv, priv, __ATOMIC_RELEASE);
+}
+
+static mbrm_trace_t mbrm_trace =
+{
+    .init = _mbrm_trace_init,
+    .record = _mbrm_trace_record,
+    .read = _mbrm_trace_read,
+    .dump_pcap = _mbrm_trace_dump_pcap,
+    .clear = _mbrm_trace_clear,
+};
+
+/**
+ * @brief
+ * @param
+ * @return
+ */
+const mbrm_trace_t *mbrm_get_trace(void)
+{
+    return &mbrm_trace;
+}
+
+#endif /* MBRM_TRACE_SWITCH */
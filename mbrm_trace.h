@@ -0,0 +1,87 @@
+/*
+ * mbrm_trace.h
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _MODBUS_RTU_MASTER_MBRM_TRACE_H_
+#define _MODBUS_RTU_MASTER_MBRM_TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mbrm_cfg.h"
+
+/**
+ * Link type written to the pcap header. LINKTYPE_USER0, map it to the
+ * "mbrtu" dissector in Wireshark (Preferences -> Protocols -> DLT_USER).
+ */
+#define MBRM_TRACE_PCAP_LINKTYPE 147
+
+typedef enum
+{
+    MBRM_TRACE_TX = 0,
+    MBRM_TRACE_RX,
+    MBRM_TRACE_TIMER_START,
+    MBRM_TRACE_TIMER_OVER,
+    MBRM_TRACE_RETRY,
+    MBRM_TRACE_POP,
+} mbrm_trace_type_t;
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t time;
+    uint8_t type;
+    uint8_t arg;
+    uint16_t len;
+    uint8_t data[MBRM_TRACE_SNAP_LENTH];
+} mbrm_trace_event_t;
+
+typedef struct
+{
+    uint32_t head;
+    uint32_t (*get_time_us)(void);
+    mbrm_trace_event_t ring[MBRM_TRACE_DEPTH];
+} mbrm_trace_private_t;
+
+typedef struct
+{
+    /* PRIVATE */
+    char priv[sizeof(mbrm_trace_private_t)];
+
+    /* PUBLIC */
+    void (*init)(uint32_t (*get_time_us)(void));
+    void (*record)(mbrm_trace_type_t type, uint8_t arg, const uint8_t *data, uint16_t len);
+    uint32_t (*read)(mbrm_trace_event_t *events, uint32_t max);
+    int (*dump_pcap)(void (*out)(const void *, size_t));
+    void (*clear)(void);
+} mbrm_trace_t;
+
+const mbrm_trace_t *mbrm_get_trace(void);
+
+#if MBRM_TRACE_SWITCH
+    #define MBRM_TRACE(_type_, _arg_, _data_, _len_) mbrm_get_trace()->record(_type_, _arg_, _data_, _len_)
+#else
+    #define MBRM_TRACE(_type_, _arg_, _data_, _len_)
+#endif
+
+#endif /* _MODBUS_RTU_MASTER_MBRM_TRACE_H_ */
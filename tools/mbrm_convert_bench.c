@@ -0,0 +1,238 @@
+/*
+ * mbrm_convert_bench.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Engineering value conversion, fused into decode against decode-then-convert.
+ *
+ *   gcc -O2 -I.. -o mbrm_convert_bench mbrm_convert_bench.c ../mbrm_device.c ../mbrm_protocol.c \
+ *       ../mbrm_trace.c ../mbrm_rec.c ../mbrm_shm.c ../mbrm_mem.c
+ *   mbrm_convert_bench [-n rounds]
+ *
+ * Feeds the same 0x03 block of 124 registers n times (def: 50000) through
+ * dev_feed for every type, big endian on the wire. The split row decodes a
+ * raw MBRM_TYPE_16/MBRM_TYPE_32 command and converts it afterwards in
+ * scalar code, the way consumers did it before the typed commands. The
+ * fused row decodes the typed command with value set, so conversion runs
+ * in the same pass. Each row is the best of 5 runs.
+ *
+ * ns/reg  Time per register of the block, both rows include the feed lookup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mbrm_device.h"
+
+#define REG_NUM 124
+#define RUN_NUM 5
+
+static uint8_t wire[REG_NUM * 2];
+static uint8_t raw[REG_NUM * 2];
+static uint8_t typed[REG_NUM * 2];
+static mbrm_value_t value[REG_NUM];
+static mbrm_value_t out[REG_NUM];
+static volatile mbrm_value_t sink;
+
+static void _write(const uint8_t *data, uint16_t len)
+{
+    (void)data;
+    (void)len;
+}
+
+static void _timer(uint16_t ms)
+{
+    (void)ms;
+}
+
+static double _now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Convert a raw block the way consumers did before the typed commands.
+ * @param type
+ * @param num Elements.
+ */
+static void _convert(mbrm_device_type_t type, uint16_t num, mbrm_value_t scale, mbrm_value_t offset)
+{
+    const uint16_t *w16 = (const uint16_t *)raw;
+    const uint32_t *w32 = (const uint32_t *)raw;
+    uint64_t u64;
+    int32_t i32;
+    float f32;
+    double f64;
+    uint16_t i;
+
+    for (i = 0; i < num; i++)
+    {
+        switch (type)
+        {
+        case MBRM_TYPE_INT16:
+            out[i] = (int16_t)w16[i] * scale + offset;
+            break;
+        case MBRM_TYPE_INT32:
+            i32 = (int32_t)w32[i];
+            out[i] = (mbrm_value_t)i32 * scale + offset;
+            break;
+        case MBRM_TYPE_FLOAT32:
+            memcpy(&f32, &w32[i], 4);
+            out[i] = f32 * scale + offset;
+            break;
+        case MBRM_TYPE_FLOAT64:
+            u64 = (uint64_t)w16[i * 4] << 48 | (uint64_t)w16[i * 4 + 1] << 32 |
+                  (uint64_t)w16[i * 4 + 2] << 16 | w16[i * 4 + 3];
+            memcpy(&f64, &u64, 8);
+            out[i] = (mbrm_value_t)(f64 * scale + offset);
+            break;
+        default:
+            out[i] = w16[i] * scale + offset;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief
+ * @param name
+ * @param type Typed command of the fused row.
+ * @param rounds
+ */
+static void _bench(const char *name, mbrm_device_type_t type, uint32_t rounds)
+{
+    const mbrm_device_class_t *dev = get_mbrm_devive_obj();
+    uint8_t size = (type == MBRM_TYPE_FLOAT64) ? 8 : (type == MBRM_TYPE_INT32 || type == MBRM_TYPE_FLOAT32) ? 4 : 2;
+    uint16_t num = REG_NUM * 2 / size;
+    mbrm_device_cmd_t split_cmd =
+    {
+        .cmd = 0x03,
+        .register_addr = 0,
+        .num = (size == 4) ? num : REG_NUM,
+        .type = (size == 4) ? MBRM_TYPE_32 : MBRM_TYPE_16,
+        .data = raw,
+    };
+    mbrm_device_cmd_t fused_cmd =
+    {
+        .cmd = 0x03,
+        .register_addr = 0,
+        .num = num,
+        .type = type,
+        .data = typed,
+        .value = value,
+        .scale = 0.1f,
+        .offset = 2,
+    };
+    mbrm_device_info_t split = {.name = "raw", .slave_addr = 1, .mode_16 = MBRM_DEV_16_12, .mode_32 = MBRM_DEV_32_1234,
+                                .cmd_list = &split_cmd, .cmd_num = 1};
+    mbrm_device_info_t fused = {.name = "typ", .slave_addr = 2, .mode_16 = MBRM_DEV_16_12, .mode_32 = MBRM_DEV_32_1234,
+                                .cmd_list = &fused_cmd, .cmd_num = 1};
+    double t0, t, split_ns = 0, fused_ns = 0;
+    uint32_t r;
+    int k;
+
+    dev->dev_register(&split);
+    dev->dev_register(&fused);
+
+    /* Best of a few runs, so a busy machine does not decide the ratio. */
+    for (k = 0; k < RUN_NUM; k++)
+    {
+        t0 = _now_ns();
+        for (r = 0; r < rounds; r++)
+        {
+            dev->dev_feed(1, 0, wire, REG_NUM, NULL);
+            _convert(type, num, 0.1f, 2);
+            sink = out[r % num];
+        }
+        t = _now_ns() - t0;
+        split_ns = (k == 0 || t < split_ns) ? t : split_ns;
+
+        t0 = _now_ns();
+        for (r = 0; r < rounds; r++)
+        {
+            dev->dev_feed(2, 0, wire, REG_NUM, NULL);
+            sink = value[r % num];
+        }
+        t = _now_ns() - t0;
+        fused_ns = (k == 0 || t < fused_ns) ? t : fused_ns;
+    }
+
+    if (memcmp(out, value, num * sizeof(mbrm_value_t)) != 0)
+    {
+        printf("%-8s values differ\n", name);
+    }
+    printf("%-8s %5u %10.2f %10.2f %7.2fx\n", name, num, split_ns / rounds / REG_NUM,
+           fused_ns / rounds / REG_NUM, split_ns / fused_ns);
+
+    dev->dev_detach("raw");
+    dev->dev_detach("typ");
+}
+
+int main(int argc, char *argv[])
+{
+    mbrm_init_cfg cfg = {0};
+    uint32_t rounds = 50000;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < (int)sizeof(wire); i++)
+    {
+        wire[i] = (uint8_t)(i * 37 + 11);
+    }
+    /* Keep the 64 bit patterns finite. */
+    for (i = 0; i < (int)sizeof(wire); i += 8)
+    {
+        wire[i] = 0x40;
+    }
+    cfg.write_cb = _write;
+    cfg.timer_start_cb = _timer;
+    cfg.baud = 9600;
+    get_mbrm_devive_obj()->init(&cfg);
+
+    printf("%-8s %5s %10s %10s %8s\n", "type", "elems", "split", "fused", "speedup");
+    _bench("int16", MBRM_TYPE_INT16, rounds);
+    _bench("uint16", MBRM_TYPE_UINT16, rounds);
+    _bench("int32", MBRM_TYPE_INT32, rounds);
+    _bench("float32", MBRM_TYPE_FLOAT32, rounds);
+    _bench("float64", MBRM_TYPE_FLOAT64, rounds);
+
+    return 0;
+}
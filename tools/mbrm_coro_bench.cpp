@@ -0,0 +1,183 @@
+/*
+ * mbrm_coro_bench.cpp
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Host cost of the coroutine layer against the callback API.
+ *
+ *   gcc -O2 -I.. -c ../mbrm_device.c ../mbrm_protocol.c ../mbrm_sim.c ../mbrm_trace.c \
+ *       ../mbrm_rec.c ../mbrm_shm.c ../mbrm_mem.c
+ *   g++ -std=c++20 -O2 -I.. -o mbrm_coro_bench mbrm_coro_bench.cpp *.o
+ *   mbrm_coro_bench [-n requests] [-q registers]
+ *
+ * Reads q registers (def: 10) n times (def: 100000) back to back from the
+ * simulated bus, once with dev_request and a completion callback that
+ * issues the next request, once from a coroutine awaiting device::read.
+ * The bus runs on virtual time, so both rows take the same bus time and
+ * the wall clock only measures the library and the wrapper.
+ *
+ * ns/req  Host time per request, best of 5 runs.
+ * bus_s   Virtual bus time of the run.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "mbrm_coro.hpp"
+
+extern "C" {
+#include "mbrm_sim.h"
+}
+
+#define RUN_NUM 5
+
+static uint16_t bank[125];
+static uint16_t data[125];
+static mbrm_device_cmd_t cmd;
+static mbrm_device_info_t info;
+static uint32_t request_num = 100000;
+static uint32_t done_num, fail_num;
+
+static void _callback(mbrm_queue_status_t status, void *, void *)
+{
+    mbrm_device_req_t req = {0, _callback, nullptr};
+
+    fail_num += (status != MBRM_QUEUE_STATUS_FINISH);
+    if (++done_num < request_num)
+    {
+        get_mbrm_devive_obj()->dev_request(info.name, 0, &req, nullptr);
+    }
+}
+
+static mbrm::task _reader(const mbrm::device &dev)
+{
+    while (done_num < request_num)
+    {
+        auto r = co_await dev.read<uint16_t>(0);
+        fail_num += !r.ok();
+        done_num++;
+    }
+}
+
+/**
+ * @brief
+ * @param coro
+ * @param bus_us Virtual time of the run.
+ * @return Host time of the run, in ns.
+ */
+static double _run(bool coro, const mbrm::device &dev, uint64_t *bus_us)
+{
+    mbrm_device_req_t req = {0, _callback, nullptr};
+    uint64_t start = mbrm_get_sim()->get_time();
+    auto t0 = std::chrono::steady_clock::now();
+
+    done_num = 0;
+    if (coro)
+    {
+        _reader(dev);
+    }
+    else
+    {
+        get_mbrm_devive_obj()->dev_request(info.name, 0, &req, nullptr);
+    }
+    mbrm_get_sim()->run_idle(~0ULL);
+
+    *bus_us = mbrm_get_sim()->get_time() - start;
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char *argv[])
+{
+    mbrm_init_cfg init_cfg = {};
+    mbrm_sim_cfg_t sim_cfg = {};
+    double best[2] = {0, 0}, t;
+    uint64_t bus_us[2] = {0, 0};
+    int opt, k, i;
+
+    cmd.cmd = 0x03;
+    cmd.num = 10;
+    cmd.type = MBRM_TYPE_16;
+    cmd.data = data;
+    while ((opt = getopt(argc, argv, "n:q:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            request_num = strtoul(optarg, nullptr, 0);
+            break;
+        case 'q':
+            cmd.num = atoi(optarg);
+            break;
+        default:
+            std::fprintf(stderr, "usage: %s [-n requests] [-q registers]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (request_num == 0 || cmd.num < 1 || cmd.num > 125)
+    {
+        std::fprintf(stderr, "bad option\n");
+        return 1;
+    }
+
+    std::strcpy(info.name, "m1");
+    info.slave_addr = 1;
+    info.repeat_max = 1;
+    info.over_time = 100;
+    info.mode_16 = MBRM_DEV_16_12;
+    info.cmd_list = &cmd;
+    info.cmd_num = 1;
+
+    sim_cfg.baud = 115200;
+    sim_cfg.turnaround_us = 1000;
+    sim_cfg.slave_addr = 1;
+    sim_cfg.regs = bank;
+    sim_cfg.reg_num = 125;
+    mbrm_get_sim()->init(&sim_cfg, &init_cfg);
+    init_cfg.baud = sim_cfg.baud;
+    get_mbrm_devive_obj()->init(&init_cfg);
+
+    mbrm::device dev(info);
+    if (dev.status() != 0)
+    {
+        std::fprintf(stderr, "register fail\n");
+        return 1;
+    }
+
+    for (k = 0; k < RUN_NUM; k++)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            t = _run(i == 1, dev, &bus_us[i]);
+            best[i] = (k == 0 || t < best[i]) ? t : best[i];
+        }
+    }
+
+    std::printf("%u requests of %d registers, %u failed\n", request_num, cmd.num, fail_num);
+    std::printf("%-9s %8s %8s\n", "api", "ns/req", "bus_s");
+    std::printf("%-9s %8.1f %8.2f\n", "callback", best[0] / request_num, bus_us[0] / 1e6);
+    std::printf("%-9s %8.1f %8.2f\n", "coroutine", best[1] / request_num, bus_us[1] / 1e6);
+    return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * mbrm_fault_report.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Goodput of the retry and timeout policy on a degraded line.
+ *
+ *   gcc -I.. -o mbrm_fault_report mbrm_fault_report.c ../mbrm_sim.c ../mbrm_protocol.c \
+ *       ../mbrm_trace.c ../mbrm_rec.c
+ *   mbrm_fault_report [-t seconds] [-b baud] [-n slaves] [-q registers] [-r repeat_max]
+ *                     [-o over_time_ms] [-s seed] [-e ber_ppm] [-l drop_ppm] [-c truncate_ppm]
+ *                     [-u duplicate_ppm] [-L late_ppm:late_us] [-j jitter_us] [-T tail_ppm:tail_us]
+ *
+ * Polls n slaves (def: 8) of the simulated bus round robin, q registers
+ * (def: 10) per read, keeping the RTU queue full for t seconds of virtual
+ * time (def: 60). Without fault options a set of typical faults is run,
+ * one row each, otherwise one row for the faults given.
+ *
+ * goodput  Registers read successfully per second.
+ * ok       Reads finished, of all reads popped.
+ * retry    Frames sent per read minus 1.
+ * p50/p99/max  Latency of finished reads from the first transmission, ms.
+ * stale    Answers with a good CRC dropped as not answering the request on the bus.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mbrm_sim.h"
+
+#define RTT_MAX 200000
+
+typedef struct
+{
+    const char *name;
+    mbrm_sim_fault_t fault;
+} scenario_t;
+
+static uint16_t regs[125];
+static uint8_t rx_buf[256];
+static uint32_t rtt[RTT_MAX];
+static uint32_t rtt_num, popped, finished, next_slave;
+/* Frames sent by the popped reads, the one on the bus at the cut-off is not counted. */
+static uint64_t popped_frames;
+static uint8_t draining;
+static uint32_t slave_num = 8, reg_num = 10, repeat_max = 3, over_time = 100;
+
+static void _pop(uint8_t poped);
+
+static void _send(void)
+{
+    mbrm_unit_cfg_t cfg =
+    {
+        .cmd = 0x03,
+        .slave_addr = 1 + next_slave++ % slave_num,
+        .register_addr = 0,
+        .len = reg_num,
+        .repeat_max = repeat_max,
+        .over_time = over_time,
+        .flags = MBRM_UNIT_FLAG_EXACT_TIME,
+        .data = rx_buf,
+        .pop_sigingal = _pop,
+    };
+    mbrm_get_protocol()->send_cmd(&cfg);
+}
+
+static void _pop(uint8_t poped)
+{
+    const mbrm_communication_unit_t *unit = mbrm_get_protocol()->get_unit_in_queue(poped);
+
+    if (draining)
+    {
+        return;
+    }
+    popped++;
+    /* repeat is one past repeat_max once the last try timed out. */
+    popped_frames += (unit->repeat > unit->cfg.repeat_max) ? unit->cfg.repeat_max : unit->repeat;
+    if (unit->status == MBRM_QUEUE_STATUS_FINISH)
+    {
+        finished++;
+        if (rtt_num < RTT_MAX)
+        {
+            rtt[rtt_num++] = mbrm_get_sim()->get_time_us() - unit->start_us;
+        }
+    }
+    _send();
+}
+
+static int _cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void _run(const char *name, const mbrm_sim_fault_t *fault, uint32_t seconds, uint32_t baud)
+{
+    mbrm_init_cfg init_cfg;
+    mbrm_sim_cfg_t cfg;
+    mbrm_protocol_stat_t pstat;
+    uint32_t i;
+
+    memset(&init_cfg, 0, sizeof(init_cfg));
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.baud = baud;
+    cfg.turnaround_us = 2000;
+    cfg.regs = regs;
+    cfg.reg_num = 125;
+    cfg.fault = *fault;
+    mbrm_get_sim()->init(&cfg, &init_cfg);
+    init_cfg.baud = baud;
+    mbrm_get_protocol()->init(&init_cfg);
+
+    rtt_num = popped = finished = next_slave = 0;
+    popped_frames = 0;
+    for (i = 0; i < MBRM_COMMUNICATION_QUEUE_MAX_LENTH; i++)
+    {
+        _send();
+    }
+    mbrm_get_sim()->run_until((uint64_t)seconds * 1000000);
+    mbrm_get_protocol()->get_stat(&pstat);
+    /* Empty the queue for the next run, init keeps it. */
+    draining = 1;
+    mbrm_get_sim()->run_idle(~0ULL);
+    draining = 0;
+
+    qsort(rtt, rtt_num, sizeof(rtt[0]), _cmp_u32);
+    printf("%-16s %9.1f %6.2f%% %6.3f %7.1f %7.1f %7.1f %6u\n", name,
+           (double)finished * reg_num / seconds,
+           popped ? 100.0 * finished / popped : 0.0,
+           popped ? (double)popped_frames / popped - 1 : 0.0,
+           rtt_num ? rtt[rtt_num / 2] / 1000.0 : 0.0,
+           rtt_num ? rtt[(uint64_t)rtt_num * 99 / 100] / 1000.0 : 0.0,
+           rtt_num ? rtt[rtt_num - 1] / 1000.0 : 0.0,
+           pstat.foreign + pstat.early + pstat.mismatch);
+}
+
+static void _pair(const char *arg, uint32_t *a, uint32_t *b)
+{
+    if (sscanf(arg, "%u:%u", a, b) != 2)
+    {
+        fprintf(stderr, "expected ppm:us, got %s\n", arg);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const scenario_t scenarios[] =
+    {
+        {"clean", {.seed = 1}},
+        {"ber 1e-5", {.seed = 1, .bit_error_ppm = 10}},
+        {"ber 1e-4", {.seed = 1, .bit_error_ppm = 100}},
+        {"drop 1%", {.seed = 1, .drop_ppm = 10000}},
+        {"drop 5%", {.seed = 1, .drop_ppm = 50000}},
+        {"truncate 1%", {.seed = 1, .truncate_ppm = 10000}},
+        {"duplicate 1%", {.seed = 1, .duplicate_ppm = 10000}},
+        {"late 1% +150ms", {.seed = 1, .late_ppm = 10000, .late_us = 150000}},
+        {"jitter 20ms", {.seed = 1, .latency = {.jitter_us = 20000}}},
+        {"tail 2% +90ms", {.seed = 1, .latency = {.tail_ppm = 20000, .tail_us = 90000}}},
+    };
+    mbrm_sim_fault_t fault;
+    uint32_t seconds = 60, baud = 9600, i;
+    uint8_t custom = 0;
+    int opt;
+
+    memset(&fault, 0, sizeof(fault));
+    fault.seed = 1;
+    while ((opt = getopt(argc, argv, "t:b:n:q:r:o:s:e:l:c:u:L:j:T:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': seconds = atoi(optarg); break;
+        case 'b': baud = atoi(optarg); break;
+        case 'n': slave_num = atoi(optarg); break;
+        case 'q': reg_num = atoi(optarg); break;
+        case 'r': repeat_max = atoi(optarg); break;
+        case 'o': over_time = atoi(optarg); break;
+        case 's': fault.seed = atoi(optarg); break;
+        case 'e': fault.bit_error_ppm = atoi(optarg); custom = 1; break;
+        case 'l': fault.drop_ppm = atoi(optarg); custom = 1; break;
+        case 'c': fault.truncate_ppm = atoi(optarg); custom = 1; break;
+        case 'u': fault.duplicate_ppm = atoi(optarg); custom = 1; break;
+        case 'L': _pair(optarg, &fault.late_ppm, &fault.late_us); custom = 1; break;
+        case 'j': fault.latency.jitter_us = atoi(optarg); custom = 1; break;
+        case 'T': _pair(optarg, &fault.latency.tail_ppm, &fault.latency.tail_us); custom = 1; break;
+        default:
+            fprintf(stderr, "usage: see the top of %s.c\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seconds == 0 || baud == 0 || slave_num == 0 || reg_num == 0 || reg_num > 125 ||
+            repeat_max == 0 || repeat_max > 255 || over_time == 0 || over_time > 65535)
+    {
+        fprintf(stderr, "parameter out of range\n");
+        return 1;
+    }
+
+    printf("%d baud, %d slaves, %d registers, repeat %d, over_time %d ms, %d s\n",
+           baud, slave_num, reg_num, repeat_max, over_time, seconds);
+    printf("%-16s %9s %7s %6s %7s %7s %7s %6s\n", "faults", "goodput", "ok", "retry", "p50", "p99", "max", "stale");
+    if (custom)
+    {
+        _run("custom", &fault, seconds, baud);
+        return 0;
+    }
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        fault = scenarios[i].fault;
+        _run(scenarios[i].name, &fault, seconds, baud);
+    }
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * mbrm_plan_cli.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Bus capacity planner.
+ *
+ *   gcc -I.. -o mbrm_plan mbrm_plan_cli.c ../mbrm_*.c
+ *   mbrm_plan [-b baud] [-f 8E1] [-t turnaround_us] [table.csv]
+ *
+ * One command per line, lines of a device kept together:
+ *   name,slave,func,register,num,type[,period_ms[,turnaround_us]]
+ * type is 16, 32 or 64, func is 3, 6 or 16. Lines starting with # are
+ * skipped. Exits with 1 when a period cannot be met.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mbrm_plan.h"
+
+#define PLAN_DEV_MAX 64
+#define PLAN_CMD_MAX 512
+
+static mbrm_device_info_t devs[PLAN_DEV_MAX];
+static mbrm_device_cmd_t cmds[PLAN_CMD_MAX];
+static mbrm_plan_cmd_t out[PLAN_CMD_MAX];
+static uint32_t turnaround[256];
+
+static uint32_t _plan_turnaround(uint8_t slave_addr)
+{
+    return turnaround[slave_addr];
+}
+
+/**
+ * @brief 8N1, 8E1, 8N2 ...
+ * @param s
+ * @return Bits per character; 0: Format err.
+ */
+static uint8_t _plan_char_bits(const char *s)
+{
+    if (strlen(s) != 3 || s[0] < '7' || s[0] > '8' || strchr("NEO", s[1]) == NULL || s[2] < '1' || s[2] > '2')
+    {
+        return 0;
+    }
+    return 1 + (s[0] - '0') + (s[1] != 'N') + (s[2] - '0');
+}
+
+/**
+ * @brief
+ * @param in
+ * @return Number of devices; -1: Table err.
+ */
+static int _plan_load(FILE *in)
+{
+    char line[256], name[16];
+    unsigned slave, func, reg, num, type, period, ta;
+    int dev_num = 0, cmd_num = 0, n, lineno = 0;
+    mbrm_device_info_t *pdev = NULL;
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+        {
+            continue;
+        }
+        period = 0;
+        ta = 0;
+        n = sscanf(line, "%15[^,],%u,%u,%u,%u,%u,%u,%u", name, &slave, &func, &reg, &num, &type, &period, &ta);
+        if (n < 6 || strlen(name) >= MBRM_DEVICE_NAME_LENTH || slave > 255 ||
+                (func != 3 && func != 6 && func != 16) || (type != 16 && type != 32 && type != 64))
+        {
+            fprintf(stderr, "line %d: bad entry\n", lineno);
+            return -1;
+        }
+        if (cmd_num >= PLAN_CMD_MAX)
+        {
+            fprintf(stderr, "line %d: too many commands\n", lineno);
+            return -1;
+        }
+
+        if (pdev == NULL || strcmp(pdev->name, name) != 0)
+        {
+            if (dev_num >= PLAN_DEV_MAX)
+            {
+                fprintf(stderr, "line %d: too many devices\n", lineno);
+                return -1;
+            }
+            pdev = &devs[dev_num++];
+            strcpy(pdev->name, name);
+            pdev->slave_addr = slave;
+            pdev->cmd_list = &cmds[cmd_num];
+        }
+        cmds[cmd_num].cmd = (func == 16) ? 0x10 : func;
+        cmds[cmd_num].register_addr = reg;
+        cmds[cmd_num].num = num;
+        cmds[cmd_num].type = (type == 16) ? MBRM_TYPE_16 : (type == 32) ? MBRM_TYPE_32 : MBRM_TYPE_FLOAT64;
+        cmds[cmd_num].period_ms = period;
+        cmd_num++;
+        pdev->cmd_num++;
+        if (ta != 0)
+        {
+            turnaround[slave] = ta;
+        }
+    }
+    return dev_num;
+}
+
+int main(int argc, char **argv)
+{
+    mbrm_plan_cfg_t cfg = {.baud = 9600, .char_bits = 11, .turnaround_us = 5000, .turnaround_cb = _plan_turnaround};
+    mbrm_init_cfg init_cfg = {0};
+    mbrm_plan_result_t result;
+    FILE *in = stdin;
+    int i, dev_num, ret;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            cfg.baud = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+            cfg.char_bits = _plan_char_bits(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            cfg.turnaround_us = strtoul(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] != '-' && in == stdin)
+        {
+            in = fopen(argv[i], "r");
+            if (in == NULL)
+            {
+                perror(argv[i]);
+                return 2;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-b baud] [-f 8E1] [-t turnaround_us] [table.csv]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (cfg.baud == 0 || cfg.char_bits == 0)
+    {
+        fprintf(stderr, "bad baud or character format\n");
+        return 2;
+    }
+
+    dev_num = _plan_load(in);
+    if (dev_num < 0)
+    {
+        return 2;
+    }
+    get_mbrm_devive_obj()->init(&init_cfg);
+    for (i = 0; i < dev_num; i++)
+    {
+        if (get_mbrm_devive_obj()->dev_register(&devs[i]) != 0)
+        {
+            fprintf(stderr, "%s: register fail\n", devs[i].name);
+            return 2;
+        }
+    }
+
+    ret = mbrm_get_plan()->run(&cfg, out, PLAN_CMD_MAX, &result);
+    printf("%-5s %3s %4s %6s %10s %10s %10s %10s\n", "dev", "cmd", "func", "frames", "bus_ms", "latency_ms", "retry_ms", "period_ms");
+    for (i = 0; i < result.cmd_num; i++)
+    {
+        printf("%-5s %3d 0x%02x %6d %10.2f %10.2f %10.2f %10u%s\n", out[i].name, out[i].cmd, out[i].func, out[i].frames,
+               out[i].bus_us / 1000.0, out[i].latency_us / 1000.0, out[i].retry_us / 1000.0, out[i].period_ms,
+               out[i].ok ? "" : "  MISSED");
+    }
+    printf("\ncycle %.2f ms, utilization %.1f %%, %d period(s) missed\n",
+           result.cycle_us / 1000.0, result.utilization / 10.0, result.violations);
+    return (ret > 0) ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * mbrm_rec_dump.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Flight recorder reader.
+ *
+ *   gcc -I.. -o mbrm_rec_dump mbrm_rec_dump.c
+ *   mbrm_rec_dump [-i interval_s] [-r] file
+ *
+ * Prints latency and failures per slave, then per interval of time
+ * (def: 3600 s). -r also lists every record, oldest first.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mbrm_rec.h"
+
+typedef struct
+{
+    uint32_t total;
+    uint32_t status[MBRM_QUEUE_STATUS_EXPIRED + 1];
+    uint32_t retries;
+    uint32_t *rtt;
+    uint32_t rtt_num;
+} slave_stat_t;
+
+static slave_stat_t slaves[256];
+
+static int _cmp_seq(const void *a, const void *b)
+{
+    const mbrm_rec_record_t *ra = a, *rb = b;
+    return (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+static int _cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static const char *_status_name(uint8_t status)
+{
+    static const char *names[] = {"ok", "wait", "timeout", "error", "cancel", "expired"};
+    return (status <= MBRM_QUEUE_STATUS_EXPIRED) ? names[status] : "?";
+}
+
+static void _fmt_time(uint64_t ns, char *buf, size_t len)
+{
+    time_t t = ns / 1000000000ULL;
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+int main(int argc, char **argv)
+{
+    mbrm_rec_header_t header;
+    mbrm_rec_record_t *recs;
+    uint64_t interval = 3600, bucket, bucket_end;
+    uint32_t i, n = 0, fail, total;
+    uint64_t rtt_sum;
+    const char *path = NULL;
+    int raw = 0, a;
+    char tbuf[32];
+    FILE *f;
+
+    for (a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "-i") == 0 && a + 1 < argc)
+        {
+            interval = strtoull(argv[++a], NULL, 10);
+        }
+        else if (strcmp(argv[a], "-r") == 0)
+        {
+            raw = 1;
+        }
+        else if (argv[a][0] != '-' && path == NULL)
+        {
+            path = argv[a];
+        }
+        else
+        {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL || interval == 0)
+    {
+        fprintf(stderr, "usage: %s [-i interval_s] [-r] file\n", argv[0]);
+        return 2;
+    }
+
+    f = fopen(path, "rb");
+    if (f == NULL || fread(&header, sizeof(header), 1, f) != 1 ||
+            memcmp(header.magic, MBRM_REC_MAGIC, 8) != 0 || header.record_size != sizeof(mbrm_rec_record_t))
+    {
+        fprintf(stderr, "%s: not a flight recorder file\n", path);
+        return 2;
+    }
+    recs = malloc((size_t)header.capacity * sizeof(mbrm_rec_record_t));
+    if (recs == NULL || fread(recs, sizeof(mbrm_rec_record_t), header.capacity, f) != header.capacity)
+    {
+        fprintf(stderr, "%s: truncated\n", path);
+        return 2;
+    }
+    fclose(f);
+
+    /* Keep the slots written completely, then order them. */
+    for (i = 0; i < header.capacity; i++)
+    {
+        if (recs[i].seq != 0 && (recs[i].seq - 1) % header.capacity == i)
+        {
+            recs[n++] = recs[i];
+        }
+    }
+    qsort(recs, n, sizeof(mbrm_rec_record_t), _cmp_seq);
+    printf("%u records of %u, %llu written\n", n, header.capacity, (unsigned long long)header.head);
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    if (raw)
+    {
+        for (i = 0; i < n; i++)
+        {
+            _fmt_time(recs[i].time_ns, tbuf, sizeof(tbuf));
+            printf("%s.%03u slave %3u fc 0x%02x addr %5u n %3u %-7s retries %u exc %u rtt %.2f ms\n",
+                   tbuf, (unsigned)(recs[i].time_ns / 1000000 % 1000), recs[i].slave_addr, recs[i].cmd,
+                   recs[i].register_addr, recs[i].count, _status_name(recs[i].status), recs[i].retries,
+                   recs[i].exception, recs[i].rtt_us / 1000.0);
+        }
+        printf("\n");
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        slave_stat_t *s = &slaves[recs[i].slave_addr];
+        if (s->rtt == NULL)
+        {
+            s->rtt = malloc(n * sizeof(uint32_t));
+        }
+        s->total++;
+        if (recs[i].status <= MBRM_QUEUE_STATUS_EXPIRED)
+        {
+            s->status[recs[i].status]++;
+        }
+        s->retries += recs[i].retries;
+        if (recs[i].status == MBRM_QUEUE_STATUS_FINISH && s->rtt != NULL)
+        {
+            s->rtt[s->rtt_num++] = recs[i].rtt_us;
+        }
+    }
+
+    printf("slave   total      ok timeout   error  cancel expired retries  rtt_min  rtt_avg  rtt_p99  rtt_max (ms)\n");
+    for (a = 0; a < 256; a++)
+    {
+        slave_stat_t *s = &slaves[a];
+        if (s->total == 0)
+        {
+            continue;
+        }
+        rtt_sum = 0;
+        for (i = 0; i < s->rtt_num; i++)
+        {
+            rtt_sum += s->rtt[i];
+        }
+        qsort(s->rtt, s->rtt_num, sizeof(uint32_t), _cmp_u32);
+        printf("%5d %7u %7u %7u %7u %7u %7u %7u", a, s->total, s->status[MBRM_QUEUE_STATUS_FINISH],
+               s->status[MBRM_QUEUE_STATUS_OVER_TIME], s->status[MBRM_QUEUE_STATUS_ERROR],
+               s->status[MBRM_QUEUE_STATUS_CANCEL], s->status[MBRM_QUEUE_STATUS_EXPIRED], s->retries);
+        if (s->rtt_num > 0)
+        {
+            printf(" %8.2f %8.2f %8.2f %8.2f", s->rtt[0] / 1000.0, rtt_sum / 1000.0 / s->rtt_num,
+                   s->rtt[(s->rtt_num * 99) / 100] / 1000.0, s->rtt[s->rtt_num - 1] / 1000.0);
+        }
+        printf("\n");
+    }
+
+    printf("\n%-19s   total    fail  fail%%  worst slave\n", "interval");
+    for (i = 0; i < n;)
+    {
+        uint32_t slave_fail[256] = {0};
+        int worst = -1;
+
+        bucket = recs[i].time_ns / 1000000000ULL / interval * interval;
+        bucket_end = (bucket + interval) * 1000000000ULL;
+        total = 0;
+        fail = 0;
+        for (; i < n && recs[i].time_ns < bucket_end; i++)
+        {
+            total++;
+            if (recs[i].status == MBRM_QUEUE_STATUS_OVER_TIME || recs[i].status == MBRM_QUEUE_STATUS_ERROR)
+            {
+                fail++;
+                if (++slave_fail[recs[i].slave_addr] > (worst < 0 ? 0 : slave_fail[worst]))
+                {
+                    worst = recs[i].slave_addr;
+                }
+            }
+        }
+        if (total > 0)
+        {
+            _fmt_time(bucket * 1000000000ULL, tbuf, sizeof(tbuf));
+            printf("%s %7u %7u %5.1f", tbuf, total, fail, 100.0 * fail / total);
+            if (worst >= 0)
+            {
+                printf("  %d (%u)", worst, slave_fail[worst]);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * mbrm_shard_bench.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Throughput of the thread-per-bus executor as buses are added.
+ *
+ *   Set MBRM_LOOP_SWITCH and MBRM_SHARD_SWITCH in mbrm_cfg.h, then
+ *   gcc -I.. -o mbrm_shard_bench mbrm_shard_bench.c ../mbrm_shard.c ../mbrm_loop.c \
+ *       ../mbrm_device.c ../mbrm_protocol.c ../mbrm_shm.c ../mbrm_mem.c ../mbrm_trace.c ../mbrm_rec.c -lpthread
+ *   mbrm_shard_bench [-n buses] [-t seconds] [-b baud] [-d turnaround_us]
+ *
+ * Each bus is a socketpair answered by a slave thread that holds the line
+ * for the time both frames take at the given baud (def: 115200) plus the
+ * turnaround (def: 500 us). One device per bus reads 2 registers with 4
+ * requests outstanding. Runs 1..n buses (def: 8) for t seconds (def: 2)
+ * each and prints the scaling against one bus.
+ *
+ * The slaves sleep out the line time, the scaling shows buses waiting on
+ * their lines in parallel, not CPU work spread over cores. Every answer
+ * also waits for the 3.5 character gap, so a bus stays bound by RTU
+ * timing however fast the slave is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "mbrm_shard.h"
+
+#if !MBRM_SHARD_SWITCH
+    #error "Set MBRM_LOOP_SWITCH and MBRM_SHARD_SWITCH in mbrm_cfg.h"
+#endif
+
+#define WINDOW 4
+
+typedef struct
+{
+    int fd;
+    uint32_t baud;
+    uint32_t turnaround_us;
+} slave_arg_t;
+
+static uint16_t regs[MBRM_SHARD_MAX][2];
+static mbrm_device_cmd_t cmds[MBRM_SHARD_MAX][1];
+static mbrm_device_info_t devs[MBRM_SHARD_MAX];
+static uint32_t done_num[MBRM_SHARD_MAX];
+static uint32_t fail_num;
+
+static uint64_t _now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint16_t _crc(const uint8_t *data, uint16_t len)
+{
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static void *_slave(void *p)
+{
+    slave_arg_t *arg = p;
+    uint8_t req[8], rsp[9];
+    uint32_t wire_us = (8 + 9) * 11 * 1000000ULL / arg->baud;
+    uint16_t crc;
+    int got, n;
+
+    for (;;)
+    {
+        for (got = 0; got < 8; got += n)
+        {
+            n = read(arg->fd, req + got, 8 - got);
+            if (n <= 0)
+            {
+                return NULL;
+            }
+        }
+        usleep(wire_us + arg->turnaround_us);
+        rsp[0] = req[0];
+        rsp[1] = 0x03;
+        rsp[2] = 4;
+        rsp[3] = 0x12;
+        rsp[4] = 0x34;
+        rsp[5] = 0x56;
+        rsp[6] = 0x78;
+        crc = _crc(rsp, 7);
+        rsp[7] = crc;
+        rsp[8] = crc >> 8;
+        if (send(arg->fd, rsp, 9, MSG_NOSIGNAL) != 9)
+        {
+            return NULL;
+        }
+    }
+}
+
+static void _on_done(const mbrm_shard_done_t *done, void *arg)
+{
+    (void)arg;
+    if (done->ret != 0 || done->status != MBRM_QUEUE_STATUS_FINISH)
+    {
+        fail_num++;
+    }
+    done_num[done->shard]++;
+    mbrm_get_shard()->send(devs[done->shard].name, 0, NULL, 0, done->shard);
+}
+
+static double _run(uint8_t num, uint32_t seconds, uint32_t baud, uint32_t turnaround_us)
+{
+    const mbrm_shard_t *shard = mbrm_get_shard();
+    mbrm_shard_bus_t buses[MBRM_SHARD_MAX];
+    slave_arg_t args[MBRM_SHARD_MAX];
+    pthread_t threads[MBRM_SHARD_MAX];
+    int sv[MBRM_SHARD_MAX][2];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t start, end;
+    uint32_t total = 0;
+    uint8_t i, k;
+
+    memset(done_num, 0, sizeof(done_num));
+    fail_num = 0;
+    for (i = 0; i < num; i++)
+    {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]);
+        memset(&devs[i], 0, sizeof(devs[i]));
+        snprintf(devs[i].name, MBRM_DEVICE_NAME_LENTH, "d%d", i);
+        devs[i].slave_addr = 1;
+        devs[i].over_time = 100;
+        devs[i].repeat_max = 1;
+        devs[i].cmd_list = cmds[i];
+        devs[i].cmd_num = 1;
+        memset(cmds[i], 0, sizeof(cmds[i]));
+        cmds[i][0].cmd = 0x03;
+        cmds[i][0].num = 2;
+        cmds[i][0].type = MBRM_TYPE_16;
+        cmds[i][0].data = regs[i];
+
+        memset(&buses[i], 0, sizeof(buses[i]));
+        buses[i].loop.fd = sv[i][0];
+        buses[i].loop.baud = baud;
+        buses[i].cpu = (cpus > 0) ? i % cpus : -1;
+        buses[i].devs = &devs[i];
+        buses[i].dev_num = 1;
+    }
+    if (shard->start(buses, num) != 0)
+    {
+        fprintf(stderr, "start fail\n");
+        exit(1);
+    }
+    for (i = 0; i < num; i++)
+    {
+        args[i].fd = sv[i][1];
+        args[i].baud = baud;
+        args[i].turnaround_us = turnaround_us;
+        pthread_create(&threads[i], NULL, _slave, &args[i]);
+    }
+
+    start = _now_us();
+    for (i = 0; i < num; i++)
+    {
+        for (k = 0; k < WINDOW; k++)
+        {
+            shard->send(devs[i].name, 0, NULL, 0, i);
+        }
+    }
+    end = start + seconds * 1000000ULL;
+    while (_now_us() < end)
+    {
+        struct pollfd pfd = {.fd = shard->get_fd(), .events = POLLIN};
+
+        poll(&pfd, 1, 100);
+        shard->poll(_on_done, NULL);
+    }
+    end = _now_us();
+    for (i = 0; i < num; i++)
+    {
+        total += done_num[i];
+    }
+
+    shard->stop();
+    for (i = 0; i < num; i++)
+    {
+        close(sv[i][0]);
+        pthread_join(threads[i], NULL);
+        close(sv[i][1]);
+    }
+    if (fail_num != 0)
+    {
+        fprintf(stderr, "%u requests failed\n", fail_num);
+    }
+    return total * 1000000.0 / (end - start);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t num = MBRM_SHARD_MAX, seconds = 2, baud = 115200, turnaround_us = 500;
+    double base = 0, rate;
+    uint8_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:b:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            num = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'b':
+            baud = atoi(optarg);
+            break;
+        case 'd':
+            turnaround_us = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n buses] [-t seconds] [-b baud] [-d turnaround_us]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num < 1 || num > MBRM_SHARD_MAX || baud == 0)
+    {
+        fprintf(stderr, "buses 1..%d, baud > 0\n", MBRM_SHARD_MAX);
+        return 1;
+    }
+
+    printf("buses      req/s    per bus  scaling\n");
+    for (i = 1; i <= num; i++)
+    {
+        rate = _run(i, seconds, baud, turnaround_us);
+        base = (i == 1) ? rate : base;
+        printf("%5d %10.1f %10.1f %7.2fx\n", i, rate, rate / i, rate / base);
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * mbrm_sim_test.c
+ * Copyright (C) 2023 fan.  All Rights Reserved.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Self-checking scan-cycle test on the simulated bus, exits non-zero on a
+ * failed check so CI can run it.
+ *
+ *   gcc -I.. -o mbrm_sim_test mbrm_sim_test.c ../mbrm_sim.c ../mbrm_protocol.c \
+ *       ../mbrm_trace.c ../mbrm_rec.c
+ *   mbrm_sim_test
+ *
+ * Every case runs on virtual time at 9600 baud, 11 bit characters and a
+ * 2 ms slave turnaround, reading 10 registers of slave 1, so the times
+ * asserted are exact.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "mbrm_sim.h"
+
+#define CHECK(_cond_)                                                      \
+    do                                                                     \
+    {                                                                      \
+        if (!(_cond_))                                                     \
+        {                                                                  \
+            printf("FAIL %s:%d: %s\n", __func__, __LINE__, #_cond_);       \
+            fail_num++;                                                    \
+        }                                                                  \
+    } while (0)
+
+/**
+ * One read: request 9167 us + gap 4011 us, turnaround 2000 us, answer of
+ * 25 bytes 28646 us + gap 4011 us.
+ */
+#define CYCLE_US 47835
+
+static uint16_t regs[125];
+static uint8_t rx_buf[256];
+static uint32_t fail_num;
+static uint32_t pop_num, chain_num;
+static mbrm_queue_status_t last_status;
+static uint64_t last_time;
+
+static void _pop(uint8_t poped);
+
+static void _send(uint8_t repeat_max, uint16_t over_time)
+{
+    mbrm_unit_cfg_t cfg =
+    {
+        .cmd = 0x03,
+        .slave_addr = 1,
+        .register_addr = 0,
+        .len = 10,
+        .repeat_max = repeat_max,
+        .over_time = over_time,
+        .flags = MBRM_UNIT_FLAG_EXACT_TIME,
+        .data = rx_buf,
+        .pop_sigingal = _pop,
+    };
+    CHECK(mbrm_get_protocol()->send_cmd(&cfg) == 0);
+}
+
+static void _pop(uint8_t poped)
+{
+    last_status = mbrm_get_protocol()->get_unit_in_queue(poped)->status;
+    last_time = mbrm_get_sim()->get_time();
+    pop_num++;
+    if (chain_num > 0)
+    {
+        chain_num--;
+        _send(1, 100);
+    }
+}
+
+static void _setup(const mbrm_sim_fault_t *fault)
+{
+    mbrm_init_cfg init_cfg;
+    mbrm_sim_cfg_t cfg;
+    uint16_t i;
+
+    memset(&init_cfg, 0, sizeof(init_cfg));
+    memset(&cfg, 0, sizeof(cfg));
+    for (i = 0; i < 125; i++)
+    {
+        regs[i] = 0x1000 + i;
+    }
+    cfg.baud = 9600;
+    cfg.turnaround_us = 2000;
+    cfg.regs = regs;
+    cfg.reg_num = 125;
+    if (fault != NULL)
+    {
+        cfg.fault = *fault;
+    }
+    mbrm_get_sim()->init(&cfg, &init_cfg);
+    init_cfg.baud = 9600;
+    mbrm_get_protocol()->init(&init_cfg);
+    pop_num = 0;
+    chain_num = 0;
+    last_time = 0;
+}
+
+/**
+ * @brief One read and ten back to back take exactly one and ten cycles.
+ */
+static void _test_cycle(void)
+{
+    mbrm_sim_stat_t stat;
+
+    _setup(NULL);
+    _send(1, 100);
+    mbrm_get_sim()->run_idle(~0ULL);
+    CHECK(pop_num == 1);
+    CHECK(last_status == MBRM_QUEUE_STATUS_FINISH);
+    CHECK(last_time == CYCLE_US);
+    CHECK(rx_buf[0] == 0x10 && rx_buf[1] == 0x00 && rx_buf[18] == 0x10 && rx_buf[19] == 0x09);
+
+    _setup(NULL);
+    chain_num = 9;
+    _send(1, 100);
+    mbrm_get_sim()->run_idle(~0ULL);
+    mbrm_get_sim()->get_stat(&stat);
+    CHECK(pop_num == 10);
+    CHECK(last_time == 10ULL * CYCLE_US);
+    CHECK(stat.tx_frames == 10 && stat.rx_frames == 10 && stat.timer_over == 0);
+}
+
+/**
+ * @brief A slave that never answers is tried repeat_max times, one
+ *        over_time each.
+ */
+static void _test_retry(void)
+{
+    mbrm_sim_fault_t fault = {.seed = 1, .drop_ppm = 1000000};
+    mbrm_sim_stat_t stat;
+
+    _setup(&fault);
+    _send(3, 100);
+    mbrm_get_sim()->run_idle(~0ULL);
+    mbrm_get_sim()->get_stat(&stat);
+    CHECK(pop_num == 1);
+    CHECK(last_status == MBRM_QUEUE_STATUS_OVER_TIME);
+    CHECK(last_time == 300000);
+    CHECK(stat.tx_frames == 3 && stat.lost == 3 && stat.timer_over == 3);
+}
+
+/**
+ * @brief A duplicated answer is dropped as stale: with nothing on the bus
+ *        it is foreign, during the next request it is too early for it.
+ */
+static void _test_stale(void)
+{
+    mbrm_sim_fault_t fault = {.seed = 1, .duplicate_ppm = 1000000};
+    mbrm_protocol_stat_t pstat;
+
+    _setup(&fault);
+    _send(1, 100);
+    mbrm_get_sim()->run_idle(~0ULL);
+    mbrm_get_protocol()->get_stat(&pstat);
+    CHECK(pop_num == 1 && last_status == MBRM_QUEUE_STATUS_FINISH);
+    CHECK(last_time == CYCLE_US);
+    CHECK(pstat.foreign == 1 && pstat.early == 0 && pstat.mismatch == 0 && pstat.corrupt == 0);
+
+    _setup(&fault);
+    chain_num = 1;
+    _send(1, 100);
+    mbrm_get_sim()->run_idle(~0ULL);
+    mbrm_get_protocol()->get_stat(&pstat);
+    CHECK(pop_num == 2 && last_status == MBRM_QUEUE_STATUS_FINISH);
+    CHECK(pstat.early == 1 && pstat.foreign == 1);
+}
+
+int main(void)
+{
+    _test_cycle();
+    _test_retry();
+    _test_stale();
+    printf("%s\n", (fail_num == 0) ? "ok" : "FAILED");
+    return (fail_num == 0) ? 0 : 1;
+}